@@ -33,10 +33,17 @@ Index::Index( int argc, char** argv )
     ifstream infile;
     string prefix;
     PreprocessFiles* fns = NULL;
+    vector<string> tmpDirs;
     bool isResume = false;
     bool didInput = false;
     bool doRevComp = true;
-    int minScore = 0;
+    bool packIds = false;
+    bool collapseDupes = false;
+    bool asyncIo = false;
+    bool useScratch = false;
+    int minScore = 0, threadCount = 1, readLen = 0, chunkCount = 1;
+    double memGb = 0;
+    uint16_t blockSize = 0;
     
     for ( int i ( 2 ); i < argc; i++ )
     {
@@ -81,8 +88,75 @@ Index::Index( int argc, char** argv )
             }
         }
         else if ( !strcmp( argv[i], "-s" ) ) minScore = stoi( argv[++i] );
+        else if ( !strcmp( argv[i], "-l" ) )
+        {
+            readLen = stoi( argv[++i] );
+            if ( readLen < 80 || readLen > MAX_READ_LEN )
+            {
+                cerr << "Error: read length must be between 80 and " << MAX_READ_LEN << "." << endl;
+                exit( EXIT_FAILURE );
+            }
+        }
         else if ( !strcmp( argv[i], "--resume" ) ) isResume = true;
         else if ( !strcmp( argv[i], "--no-rev-comp" ) ) doRevComp = false;
+        else if ( !strcmp( argv[i], "--pack-ids" ) ) packIds = true;
+        else if ( !strcmp( argv[i], "--collapse-dupes" ) ) collapseDupes = true;
+        else if ( !strcmp( argv[i], "--io-uring" ) ) asyncIo = true;
+        else if ( !strcmp( argv[i], "--scratch" ) ) useScratch = true;
+        else if ( !strcmp( argv[i], "-t" ) )
+        {
+            threadCount = stoi( argv[++i] );
+            if ( threadCount < 1 )
+            {
+                cerr << "Error: invalid thread count of " << threadCount << "." << endl;
+                exit( EXIT_FAILURE );
+            }
+        }
+        else if ( !strcmp( argv[i], "--chunks" ) )
+        {
+            chunkCount = stoi( argv[++i] );
+            if ( chunkCount < 1 )
+            {
+                cerr << "Error: invalid chunk count of " << chunkCount << "." << endl;
+                exit( EXIT_FAILURE );
+            }
+        }
+        else if ( !strcmp( argv[i], "--mem" ) )
+        {
+            memGb = stod( argv[++i] );
+            if ( memGb <= 0 )
+            {
+                cerr << "Error: invalid memory budget of " << argv[i] << " GB." << endl;
+                exit( EXIT_FAILURE );
+            }
+        }
+        else if ( !strcmp( argv[i], "--tmp-dirs" ) )
+        {
+            string dirs = argv[++i];
+            for ( size_t it = 0; it <= dirs.size(); )
+            {
+                size_t end = min( dirs.find( ',', it ), dirs.size() );
+                string dir = dirs.substr( it, end - it );
+                while ( dir.size() > 1 && dir.back() == '/' ) dir.pop_back();
+                if ( dir.empty() )
+                {
+                    cerr << "Error: empty directory in temporary directory list \"" << dirs << "\"." << endl;
+                    exit( EXIT_FAILURE );
+                }
+                tmpDirs.push_back( dir );
+                it = end + 1;
+            }
+        }
+        else if ( !strcmp( argv[i], "--blocks" ) )
+        {
+            if ( i + 1 == argc || ( strcmp( argv[i+1], "64" ) && strcmp( argv[i+1], "128" ) ) )
+            {
+                cerr << "Error: rank block size must be either 64 or 128 bytes, see usage:" << endl << endl;
+                printUsage();
+                exit( EXIT_FAILURE );
+            }
+            blockSize = stoi( argv[++i] );
+        }
         else
         {
             cerr << "Unrecognised argument: \"" << argv[i] << "\"" << endl << endl;
@@ -107,6 +181,14 @@ Index::Index( int argc, char** argv )
     }
     
     fns = new PreprocessFiles( prefix, true );
+    if ( useScratch && memGb > 0 )
+    {
+        cerr << "Error: scratch files (--scratch) and memory held files (--mem) are mutually exclusive arguments." << endl;
+        exit( EXIT_FAILURE );
+    }
+    if ( !tmpDirs.empty() ) fns->setTmpDirs( tmpDirs );
+    if ( useScratch ) fns->setScratch();
+    if ( memGb > 0 ) fns->setMemory( memGb * 1073741824 );
     
     if ( isResume && didInput )
     {
@@ -116,11 +198,11 @@ Index::Index( int argc, char** argv )
     }
     else if ( didInput )
     {
-        newTransform( fns, minScore, infile, doRevComp );
+        newTransform( fns, minScore, readLen, infile, doRevComp, threadCount, packIds, collapseDupes, asyncIo, chunkCount );
     }
     else if ( isResume )
     {
-        resumeTransform( fns );
+        resumeTransform( fns, threadCount, asyncIo, chunkCount );
     }
     else
     {
@@ -130,13 +212,13 @@ Index::Index( int argc, char** argv )
     }
     
     cout << "Preprocessing step 3 of 3: indexing transformed data..." << endl;
-    IndexWriter idx( fns, 1024, 20000 );
+    IndexWriter idx( fns, 1024, 20000, blockSize );
     
     cout << endl << "Preprocessing completed!" << endl;
     cout << "Total time taken: " << getDuration( preprocessStartTime ) << endl;
 }
 
-void Index::newTransform( PreprocessFiles* fns, int minScore, ifstream &infile, bool revComp )
+void Index::newTransform( PreprocessFiles* fns, int minScore, int readLen, ifstream &infile, bool revComp, int threadCount, bool packIds, bool collapseDupes, bool asyncIo, int chunkCount )
 {
     uint8_t fileCount = 0, pairedLibCount = 0;
     
@@ -164,12 +246,12 @@ void Index::newTransform( PreprocessFiles* fns, int minScore, ifstream &infile,
             if ( ( args.size() == 2 || args.size() == 3 ) && args[0] == "paired" )
             {
                 vector<ReadFile*> lib;
-                readFile = new ReadFile( args[1], 0, minScore );
+                readFile = new ReadFile( args[1], readLen, minScore, threadCount );
                 fileCount++;
                 lib.push_back( readFile );
                 if ( args.size() == 3 )
                 {
-                    readFile = new ReadFile( args[2], 0, minScore );
+                    readFile = new ReadFile( args[2], readLen, minScore, threadCount );
                     fileCount++;
                 }
                 lib.push_back( readFile );
@@ -178,7 +260,7 @@ void Index::newTransform( PreprocessFiles* fns, int minScore, ifstream &infile,
             }
             else if ( args.size() == 2 && args[0] == "single" )
             {
-                readFile = new ReadFile( args[1], 0, minScore );
+                readFile = new ReadFile( args[1], readLen, minScore, threadCount );
                 fileCount++;
                 vector<ReadFile*> lib = { readFile };
                 libs.push_back( lib );
@@ -203,8 +285,8 @@ void Index::newTransform( PreprocessFiles* fns, int minScore, ifstream &infile,
         }
         
         cout << "Preprocessing step 1 of 3: reading input files..." << endl << endl;
-        Transform::load( fns, libs, pairedLibCount, revComp );
-        Transform::run( fns );
+        Transform::load( fns, libs, pairedLibCount, revComp, packIds, collapseDupes, threadCount );
+        Transform::run( fns, threadCount, asyncIo, chunkCount );
     }
     else
     {
@@ -213,10 +295,10 @@ void Index::newTransform( PreprocessFiles* fns, int minScore, ifstream &infile,
     }
 }
 
-void Index::resumeTransform( PreprocessFiles* fns )
+void Index::resumeTransform( PreprocessFiles* fns, int threadCount, bool asyncIo, int chunkCount )
 {
     cout << "Resuming preprocessing..." << endl << endl;
-    Transform::run( fns );
+    Transform::run( fns, threadCount, asyncIo, chunkCount );
 }
 
 void Index::printUsage()
@@ -231,8 +313,20 @@ void Index::printUsage()
     cout << endl << "Required arguments:" << endl;
     cout << "\t-i\tInput text file containing a list of sequence read files. See notes for details." << endl;
     cout << "\t-p\tOutput prefix for transformed sequence files." << endl;
+    cout << endl << "Optional arguments:" << endl;
+    cout << "\t-l\tLongest read length, for inputs whose first 1000 reads are shorter than those that follow (default: longest of those sampled)." << endl;
+    cout << "\t-t\tNumber of threads used to transform the four character buckets of each cycle (default: 1, at most 4 are used unless the transform is chunked), and to decompress BGZF input and parse reads." << endl;
+    cout << "\t--chunks\tSplit the reads into this many chunks, transform the chunks side by side over the threads given, then merge them into the one transform; of use with more threads than the four character buckets can take. Must be given again on resume (default: 1)." << endl;
+    cout << "\t--mem\tHold temporary transform files in up to this many GB of memory, spilling any excess to disk. An interrupted run resumes from its last cycle on disk." << endl;
+    cout << "\t--tmp-dirs\tComma separated directories over which to spread the temporary transform files, ideally one per disk, so that each cycle reads from one and writes to another. The same directories must be given again on resume (default: beside the output prefix)." << endl;
+    cout << "\t--scratch\tHold the temporary transform files within one scratch file per directory and generation, so that cycles open and remove no files; suited to network and parallel file systems. Must be given again on resume." << endl;
+    cout << "\t--io-uring\tRead ahead and write behind the temporary transform files with Linux io_uring, keeping several requests in flight per file; of use where the temporary files are larger than the page cache. Falls back to blocking I/O where io_uring is unavailable." << endl;
+    cout << "\t--pack-ids\tBit-pack the temporary read id streams to the width of the largest read id. Set when the input is read, and kept on resume." << endl;
+    cout << "\t--collapse-dupes\tStore each exact duplicate read, or read pair, only once within its library, keeping a count of its copies, which the matches reported by match include. Costs around 32 bytes of memory per distinct read while reading inputs." << endl;
+    cout << "\t--blocks <64|128>\tAlso write a cache-aligned rank index with blocks of 64 or 128 bytes, used in place of the default index when querying." << endl;
     cout << endl << "Notes:" << endl;
-    cout << "\t- Accepted read file formats are fasta, fastq or a list of sequences, one per line." << endl;
+    cout << "\t- Accepted read file formats are fasta, fastq or a list of sequences, one per line, either plain or gzip-compressed." << endl;
+    cout << "\t- A read file may be given as \"-\" to read standard input, or as a named pipe or process substitution. These are read once as a stream, never rewound." << endl;
     cout << "\t- Input read libraries can be either paired or single." << endl;
     cout << "\t- Each paired read library can be input as either two separated files or one interleaved file." << endl;
     cout << "\t- Each line of the input text file is expected in one of the following forms:" << endl;
@@ -30,8 +30,8 @@ class Index
 public:
     Index( int argc, char** argv );
     
-    void newTransform( PreprocessFiles* fns, int minScore, ifstream &infile, bool revComp );
-    void resumeTransform( PreprocessFiles* fns );
+    void newTransform( PreprocessFiles* fns, int minScore, int readLen, ifstream &infile, bool revComp, int threadCount, bool packIds, bool collapseDupes, bool asyncIo, int chunkCount );
+    void resumeTransform( PreprocessFiles* fns, int threadCount, bool asyncIo, int chunkCount );
     
     void printUsage();
 private:
@@ -25,6 +25,7 @@
 #include "timer.h"
 #include "shared_functions.h"
 #include "query_flay.h"
+#include "scheduler.h"
 #include <ctime> 
 #include <iostream>
 #include <string.h>
@@ -35,6 +36,7 @@
 #include <sys/stat.h>
 #include <chrono>
 #include <iomanip>
+#include <sstream>
 
 extern Parameters params;
 
@@ -42,8 +44,8 @@ Match::Match( int argc, char** argv )
 :ir_( NULL ), qb_( NULL )
 {
     string ifn, ofn, header, seq;
-    int errors = 0;
-    bool collapse = false, mismatches = false;
+    int errors = 0, threadCount = 1;
+    bool collapse = false, mismatches = false, preload = false;
     Filenames* fns = NULL;
     
     for ( int i ( 2 ); i < argc; i++ )
@@ -102,12 +104,22 @@ Match::Match( int argc, char** argv )
                 exit( EXIT_FAILURE );
             }
         }
+        else if ( !strcmp( argv[i], "-t" ) )
+        {
+            threadCount = stoi( argv[++i] );
+            if ( threadCount < 1 )
+            {
+                cerr << "Error: invalid thread count of " << threadCount << "." << endl;
+                exit( EXIT_FAILURE );
+            }
+        }
         else if ( !strcmp( argv[i], "-s" ) ) seq = argv[++i];
         else if ( !strcmp( argv[i], "--mismatches" ) ) mismatches = true;
         else if ( !strcmp( argv[i], "--collapse" ) ) collapse = true;
+        else if ( !strcmp( argv[i], "--preload" ) ) preload = true;
     }
     
-    ir_ = new IndexReader( fns );
+    ir_ = new IndexReader( fns, preload );
     qb_ = new QueryBinaries( fns );
     
     if ( ofn.empty() ) ofn = "./match_result.fa";
@@ -115,8 +127,20 @@ Match::Match( int argc, char** argv )
     if ( !ifn.empty() )
     {
         ifstream ifs( ifn );
+        vector< pair<string, string> > inputs;
+        while ( getSeq( ifs, header, seq ) ) inputs.push_back( make_pair( header, seq ) );
+        
+        // Queries are matched in any order across threads, but gathered in input order before competing
+        vector<MatchedQuery*> matched( inputs.size(), NULL );
+        WorkScheduler::run( inputs.size(), threadCount, [&]( size_t i ){
+            matched[i] = new MatchedQuery( inputs[i].first, inputs[i].second, ir_, qb_, errors );
+        } );
         vector<MatchedQuery> queries;
-        while ( getSeq( ifs, header, seq ) ) queries.push_back( MatchedQuery( header, seq, ir_, qb_, errors ) );
+        for ( MatchedQuery* mq : matched )
+        {
+            queries.push_back( *mq );
+            delete mq;
+        }
         MatchedQuery::compete( queries );
         output( ofn, queries, true, true );
     }
@@ -140,8 +164,10 @@ void Match::match( string& q, string& header, ofstream* ofs, int errors )
     vector<Read> reads = MatchQuery( q, ir_, errors ).yield( qb_ );
     Read::sort( reads, true, 0 );
     int base = !reads.empty() ? max( -reads[0].coords_[0], 0 ) : 0;
-    if ( ofs ) ( *ofs ) << ">" << header << "|matched:" << reads.size() << endl << string( base, '-' ) << "reads" << q << endl;
-    else cout << ">" << header << "|matched:" << reads.size() << endl << string( base, '-' ) << "reads" << q << endl;
+    CharId matched = 0;
+    for ( Read& r : reads ) matched += qb_->getMultiplicity( r.id_ );
+    if ( ofs ) ( *ofs ) << ">" << header << "|matched:" << matched << endl << string( base, '-' ) << "reads" << q << endl;
+    else cout << ">" << header << "|matched:" << matched << endl << string( base, '-' ) << "reads" << q << endl;
     Lib* lib;
     unordered_set<ReadId> used;
     bool addPairs = false;
@@ -189,10 +215,25 @@ void Match::output( string ofn, vector<MatchedQuery>& queries, bool exact, bool
     unordered_set<ReadId> used;
     for ( MatchedQuery& mq : queries )
     {
-        ofs << ">" + mq.header_ << "\n" << string( params.readLen, '-' ) << mq.seq_ << "\n";
-        if ( exact ) for ( Read& r : mq.exact_ ) if ( used.insert( r.id_ ).second ) ofs << ">Exact_match_" << r.id_ << "\n" << string( max( 0, r.coords_[0]+params.readLen ), '-' ) << r.seq_ << "\n";
-        if ( inexact ) for ( MatchRead& r : mq.inexact_ ) if ( used.insert( r.id_ ).second ) ofs << ">Inexact_match_" << r.id_ << "\n" << string( max( 0, r.query_[0]-r.read_[0]+params.readLen ), '-' ) << r.seq_ << "\n";
-        if ( inexact ) for ( Read& r : mq.unmatched_ ) if ( used.insert( r.id_ ).second ) ofs << ">Inexact_match_" << r.id_ << "\n" << string( max( 0, r.coords_[0]+params.readLen ), '-' ) << r.seq_ << "\n";
+        // Reads are gathered first so that the query's header can count the copies of each collapsed read among them
+        ostringstream reads;
+        CharId matched = 0;
+        if ( exact ) for ( Read& r : mq.exact_ ) if ( used.insert( r.id_ ).second )
+        {
+            matched += qb_->getMultiplicity( r.id_ );
+            reads << ">Exact_match_" << r.id_ << "\n" << string( max( 0, r.coords_[0]+params.readLen ), '-' ) << r.seq_ << "\n";
+        }
+        if ( inexact ) for ( MatchRead& r : mq.inexact_ ) if ( used.insert( r.id_ ).second )
+        {
+            matched += qb_->getMultiplicity( r.id_ );
+            reads << ">Inexact_match_" << r.id_ << "\n" << string( max( 0, r.query_[0]-r.read_[0]+params.readLen ), '-' ) << r.seq_ << "\n";
+        }
+        if ( inexact ) for ( Read& r : mq.unmatched_ ) if ( used.insert( r.id_ ).second )
+        {
+            matched += qb_->getMultiplicity( r.id_ );
+            reads << ">Inexact_match_" << r.id_ << "\n" << string( max( 0, r.coords_[0]+params.readLen ), '-' ) << r.seq_ << "\n";
+        }
+        ofs << ">" + mq.header_ << "|matched:" << matched << "\n" << string( params.readLen, '-' ) << mq.seq_ << "\n" << reads.str();
 //        if ( exact ) for ( Read& r : mq.exact_ ) cout << "Exact_match_" << r.id_ << "\n" << string( max( 0, r.coords_[0]+params.readLen ), '-' ) << mq.seq_ << "\n";
 //        if ( inexact ) for ( MatchRead& r : mq.inexact_ ) cout << "Inexact_match_" << r.id_ << "\n" << string( max( 0, r.query_[0]-r.read_[0]+params.readLen ), '-' ) << mq.seq_ << "\n";
 //        if ( inexact ) for ( Read& r : mq.unmatched_ ) cout << "Inexact_match_" << r.id_ << "\n" << string( max( 0, r.coords_[0]+params.readLen ), '-' ) << mq.seq_ << "\n";
@@ -233,4 +274,6 @@ void Match::printUsage()
     cout << "    -i    Input sequence query file (mutually exclusive with -s)." << endl;
     cout << "    -s    Input sequence query (mutually exclusive with -i)." << endl;
     cout << "    -e    Allowed mismatches per 100 bases for inexact matching (default: 0, maximum: 15)." << endl;
+    cout << "    -t    Number of threads used to match queries from an input file (default: 1)." << endl;
+    cout << "    --preload    Load the entire BWT into memory before querying." << endl;
 }
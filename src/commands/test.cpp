@@ -28,13 +28,16 @@
 #include <cassert>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 extern Parameters params;
 
 Test::Test( int argc, char** argv )
 {
     Filenames* fns = NULL;
-    int testCount = 100000;
+    int testCount = 100000, threadCount = 1;
+    bool preload = false;
     
     for ( int i ( 2 ); i < argc; i++ )
     {
@@ -69,34 +72,58 @@ Test::Test( int argc, char** argv )
         {
             testCount = stoi( argv[++i] );
         }
+        else if ( !strcmp( argv[i], "-t" ) )
+        {
+            threadCount = stoi( argv[++i] );
+            if ( threadCount < 1 )
+            {
+                cerr << "Error: invalid thread count of " << threadCount << "." << endl;
+                exit( EXIT_FAILURE );
+            }
+        }
+        else if ( !strcmp( argv[i], "--preload" ) ) preload = true;
     }
     
-    ir_ = new IndexReader( fns );
+    ir_ = new IndexReader( fns, preload );
     qb_ = new QueryBinaries( fns );
     
+    // Sample reads up front so that the queries can be shared out among threads
     srand( time(NULL) );
-    int success = 0, failed = 0;
-    double startTime = clock();
+    vector< pair<ReadId, bool> > samples;
     for ( int i = 0; i < testCount; i++ )
     {
         ReadId id = ( ( rand() & 65535 ) << 16 | ( rand() & 65535 ) ) % params.seqCount;
-        string seq = qb_->getSequence( id );
-        bool rc = rand() % 2;
-        vector<int> q( seq.size(), 0 );
-        for ( int i = 0; i < seq.size(); i++ ) q[i] = rc ? 3 - charToInt[ seq[i] ] : charToInt[ seq.end()[-i-1] ];
-        
-        CharId rank, count;
-        ir_->setBaseAll( q[0], q[1], rank, count );
-        ( query( q, rank, count, 1 ) ? success : failed )++;
+        samples.push_back( make_pair( id, rand() % 2 ) );
     }
     
+    atomic<int> success( 0 ), failed( 0 ), next( 0 );
+    auto startTime = chrono::steady_clock::now();
+    auto worker = [&]()
+    {
+        for ( int i; ( i = next++ ) < testCount; )
+        {
+            string seq = qb_->getSequence( samples[i].first );
+            bool rc = samples[i].second;
+            vector<int> q( seq.size(), 0 );
+            for ( int i = 0; i < seq.size(); i++ ) q[i] = rc ? 3 - charToInt[ seq[i] ] : charToInt[ seq.end()[-i-1] ];
+            
+            CharId rank, count;
+            ir_->setBaseAll( q[0], q[1], rank, count );
+            ( query( q, rank, count, 1 ) ? success : failed )++;
+        }
+    };
+    vector<thread> threads;
+    for ( int i = 1; i < threadCount; i++ ) threads.push_back( thread( worker ) );
+    worker();
+    for ( thread& t : threads ) t.join();
+    
     cout << "Tested a total of " << testCount << " reads as queries." << endl;
     if ( failed ) cout << success << " were found successfully, but " << failed << " were not." << endl;
     else cout << "All " << success << " were successfully found in the BWT." << endl;
     cout << "Total time taken: " << getDuration( startTime ) << endl;
 }
 
-bool Test::query( vector<int>& q, CharId rank, CharId count, int i )
+bool Test::query( vector<int>& q, CharId rank, CharId count, int i ) const
 {
     CharCount ranks, counts;
     ir_->countRange( q[i++], rank, count, ranks, counts );
@@ -120,4 +147,6 @@ void Test::printUsage()
     cout << "    -p    Prefix for BWT data files." << endl;
     cout << endl << "Optional arguments:" << endl;
     cout << "    -c    Number of reads to query (default: 10000)." << endl;
+    cout << "    -t    Number of threads to query with (default: 1)." << endl;
+    cout << "    --preload    Load the entire BWT into memory before querying." << endl;
 }
@@ -28,7 +28,7 @@
 
 class Test
 {
-    bool query( vector<int>& q, CharId rank, CharId count, int i );
+    bool query( vector<int>& q, CharId rank, CharId count, int i ) const;
     void printUsage();
     IndexReader* ir_;
     QueryBinaries* qb_;
@@ -25,21 +25,22 @@
 #include <iostream>
 #include "constants.h"
 
-IndexReader::IndexReader( Filenames* fns )
+IndexReader::IndexReader( Filenames* fns, bool preload )
+: index_( NULL ), marks_( NULL ), blocks_( NULL )
 {
-    FILE* bin,* idx,* mer;
+    FILE* bin,* inBwt,* idx,* inBlk,* mer;
     assert( fns );
-    fns->setIndex( bin, bwt, idx, mer );
+    fns->setIndex( bin, inBwt, idx, inBlk, mer );
     CharId binId, bwtId, idxId;
     fseek( bin, 1, SEEK_SET );
     fread( &binId, 8, 1, bin );
     fclose( bin );
     
-    fread( &beginBwt, 1, 1, bwt );
-    fread( &bwtId, 8, 1, bwt );
-    fread( &bwtSize, 8, 1, bwt );
-    fread( &charCounts[4], 8, 1, bwt );
-    fread( &charCounts, 8, 4, bwt );
+    fread( &beginBwt, 1, 1, inBwt );
+    fread( &bwtId, 8, 1, inBwt );
+    fread( &bwtSize, 8, 1, inBwt );
+    fread( &charCounts[4], 8, 1, inBwt );
+    fread( &charCounts, 8, 4, inBwt );
     
     fread( &beginIdx, 1, 1, idx );
     fread( &idxId, 8, 1, idx );
@@ -52,20 +53,39 @@ IndexReader::IndexReader( Filenames* fns )
         exit( EXIT_FAILURE );
     }
     
+    if ( charCounts[4] >= UINT32_MAX && sizeof( ReadId ) < 8 )
+    {
+        cerr << "Error: these reads were indexed with 64-bit read ids. Rebuild with \"make WIDE_IDS=1\" to read them." << endl;
+        exit( EXIT_FAILURE );
+    }
+    
     charRanks[0] = charCounts[4];
     charRanks[1] = charRanks[0] + charCounts[0];
     charRanks[2] = charRanks[1] + charCounts[1];
     charRanks[3] = charRanks[2] + charCounts[2];
     
-    // Load index
-    sizePerIndex = 37;
-    fread( &indexSize, 8, 1, idx );
-    fread( &markSize, 8, 1, idx );
-    index_ = new uint8_t[indexSize * sizePerIndex];
-    marks_ = new ReadId[markSize];
-    buff = new uint8_t[bwtPerIndex*2];
-    fread( index_, 1, indexSize * sizePerIndex, idx );
-    fread( marks_, 4, markSize, idx );
+    // Prefer the blocked rank index if one was written, as it holds the BWT within its blocks
+    if ( inBlk )
+    {
+        setBlocks( inBlk, binId, preload );
+        fclose( inBlk );
+    }
+    else
+    {
+        // Rank lookups decode straight from the mapped BWT rather than seeking and reading per call
+        bwt.map( inBwt, preload );
+        
+        // Load index; each point's end count is 4 bytes unless there are too many ends for them
+        sizePerIndex = charCounts[4] < UINT32_MAX ? 37 : 41;
+        fread( &indexSize, 8, 1, idx );
+        fread( &markSize, 8, 1, idx );
+        index_ = new uint8_t[indexSize * sizePerIndex];
+        marks_ = new uint32_t[markSize];
+        fread( index_, 1, indexSize * sizePerIndex, idx );
+        fread( marks_, 4, markSize, idx );
+    }
+    fclose( inBwt );
+    fclose( idx );
     
     runFlag = 1 << 7;
     runMask = ~runFlag;
@@ -101,18 +121,18 @@ IndexReader::IndexReader( Filenames* fns )
         uint64_t merSize = pow( 4, kmer ) * 16;
         mers = new uint8_t[merSize];
         fread( mers, 1, merSize, mer );
+        fclose( mer );
     }
     else mers = NULL;
 }
 
 IndexReader::~IndexReader()
 {
-    if ( buff ) delete[] buff;
     if ( index_ ) delete[] index_;
     if ( marks_ ) delete[] marks_;
 }
 
-void IndexReader::countRange( uint8_t i, CharId rank, CharId count, CharCount &ranks, CharCount &counts )
+void IndexReader::countRange( uint8_t i, CharId rank, CharId count, CharCount &ranks, CharCount &counts ) const
 {
     if ( i > 3 )
     {
@@ -130,7 +150,7 @@ void IndexReader::countRange( uint8_t i, CharId rank, CharId count, CharCount &r
     counts.endCounts -= ranks.endCounts;
 }
 
-void IndexReader::countRange( uint8_t i, CharId rank, CharId edge, CharId count, CharCount &ranks, CharCount &edges, CharCount &counts )
+void IndexReader::countRange( uint8_t i, CharId rank, CharId edge, CharId count, CharCount &ranks, CharCount &edges, CharCount &counts ) const
 {
     if ( !count )
     {
@@ -153,7 +173,7 @@ void IndexReader::countRange( uint8_t i, CharId rank, CharId edge, CharId count,
 //    edges.endCounts -= ranks.endCounts;
 }
 
-void IndexReader::createSeeds( string &fn, int mer )
+void IndexReader::createSeeds( string &fn, int mer ) const
 {
     FILE* fp = fopen( fn.c_str(), "wb" );
     assert( mer == 12 );
@@ -169,11 +189,11 @@ void IndexReader::createSeeds( string &fn, int mer )
     fclose( fp );
 }
 
-void IndexReader::createSeeds( FILE* fp, int i, int it, int limit, CharId rank, CharId edge, CharId count )
+void IndexReader::createSeeds( FILE* fp, int i, int it, int limit, CharId rank, CharId edge, CharId count ) const
 {
     if ( it >= limit )
     {
-        ReadId outEdges = edge, outCount = count;
+        uint32_t outEdges = edge, outCount = count;
         fwrite( &rank, 8, 1, fp );
         fwrite( &outEdges, 4, 1, fp );
         fwrite( &outCount, 4, 1, fp );
@@ -186,7 +206,7 @@ void IndexReader::createSeeds( FILE* fp, int i, int it, int limit, CharId rank,
     for ( int j = 0; j < 4; j++ ) createSeeds( fp, j, it+1, limit, ranks[j], edges[j], counts[j] );
 }
 
-int IndexReader::primeOverlap( uint8_t* q, CharId &rank, CharId &count )
+int IndexReader::primeOverlap( uint8_t* q, CharId &rank, CharId &count ) const
 {
     if ( q[0] > 3 || q[1] > 3 )
     {
@@ -200,7 +220,7 @@ int IndexReader::primeOverlap( uint8_t* q, CharId &rank, CharId &count )
     return ol;
 }
 
-void IndexReader::primeOverlap( string &seq, vector<uint8_t> &q, CharId &rank, CharId &count, int &ol, bool drxn )
+void IndexReader::primeOverlap( string &seq, vector<uint8_t> &q, CharId &rank, CharId &count, int &ol, bool drxn ) const
 {
     ol = mers && seq.size() >= 12 ? 12 : 2;
     if ( drxn ) for ( int i = 0; i++ < ol; ) q.push_back( charToInt[ seq.end()[-i] ] );
@@ -217,7 +237,7 @@ void IndexReader::primeOverlap( string &seq, vector<uint8_t> &q, CharId &rank, C
     }
 }
 
-int IndexReader::setBaseAll( vector<uint8_t> &q, CharId &rank, CharId &count )
+int IndexReader::setBaseAll( vector<uint8_t> &q, CharId &rank, CharId &count ) const
 {
     rank = count = 0;
     if ( q.size() < 12 || !mers ) assert( false ); 
@@ -227,7 +247,7 @@ int IndexReader::setBaseAll( vector<uint8_t> &q, CharId &rank, CharId &count )
         assert( q[i] < 4 );
         p += pow( 4, kmerLen - i - 1 ) * q[i] * 16;
     }
-    ReadId inEdge, inCount;
+    uint32_t inEdge, inCount;
     memcpy( &rank, &mers[p], 8 );
     memcpy( &inEdge, &mers[p+8], 4 );
     memcpy( &inCount, &mers[p+12], 4 );
@@ -236,20 +256,20 @@ int IndexReader::setBaseAll( vector<uint8_t> &q, CharId &rank, CharId &count )
     return kmerLen;
 }
 
-void IndexReader::setBaseAll( uint8_t i, uint8_t j, CharId &rank, CharId &count )
+void IndexReader::setBaseAll( uint8_t i, uint8_t j, CharId &rank, CharId &count ) const
 {
     rank = baseCounts[i][j];
     count = baseCounts[ i + 1 ][j] - rank;
 }
 
-void IndexReader::setBaseAll( uint8_t i, uint8_t j, CharId &rank, CharId &edge, CharId &count )
+void IndexReader::setBaseAll( uint8_t i, uint8_t j, CharId &rank, CharId &edge, CharId &count ) const
 {
     rank = baseCounts[i][j];
     edge = midRanks[i][j] - rank;
     count = baseCounts[ i + 1 ][j] - edge - rank;
 }
 
-ReadId IndexReader::setBaseMap( uint8_t i, uint8_t j, CharId &rank, CharId &count )
+ReadId IndexReader::setBaseMap( uint8_t i, uint8_t j, CharId &rank, CharId &count ) const
 {
     ReadId base = 0;
     for ( int ii = 0; ii < i; ii++ ) base += baseCounts[0][ii];
@@ -259,15 +279,56 @@ ReadId IndexReader::setBaseMap( uint8_t i, uint8_t j, CharId &rank, CharId &coun
     return base;
 }
 
-void IndexReader::setBaseOverlap( uint8_t i, uint8_t j, CharId &rank, CharId &count )
+void IndexReader::setBaseOverlap( uint8_t i, uint8_t j, CharId &rank, CharId &count ) const
 {
     rank = midRanks[i][j];
     count = baseCounts[ i + 1 ][j] - rank;
 }
 
-void IndexReader::setRank( uint8_t i, CharId rank, CharCount &ranks )
+void IndexReader::setBlocks( FILE* inBlk, CharId binId, bool preload )
+{
+    uint8_t beginBlk;
+    CharId blkId, superCount, markCount;
+    fread( &beginBlk, 1, 1, inBlk );
+    fread( &blkId, 8, 1, inBlk );
+    fread( &blockSize, 2, 1, inBlk );
+    fread( &blocksPerSuper, 4, 1, inBlk );
+    fread( &markShift, 1, 1, inBlk );
+    fread( &blockCount, 8, 1, inBlk );
+    fread( &superCount, 8, 1, inBlk );
+    fread( &markCount, 8, 1, inBlk );
+    
+    if ( binId != blkId )
+    {
+        cerr << "Error: disagreement among data files. They may be corrupted, incomplete or from different sessions." << endl;
+        exit( EXIT_FAILURE );
+    }
+    
+    // Blocks are followed by the superblock counts and then the rank marks
+    blk.map( inBlk, preload );
+    blocks_ = blk.data + beginBlk;
+    supers_ = (CharId*)( blocks_ + blockCount * blockSize );
+    blockMarks_ = supers_ + superCount * 5;
+    assert( (uint8_t*)( blockMarks_ + markCount ) == blk.data + blk.size );
+}
+
+CharId IndexReader::setBlockRank( CharId block, CharCount &ranks ) const
+{
+    CharId* super = supers_ + ( block / blocksPerSuper ) * 5;
+    uint32_t* rel = (uint32_t*)( blocks_ + block * blockSize );
+    for ( int i = 0; i < 4; i++ ) ranks.counts[i] = super[i] + rel[i];
+    ranks.endCounts = super[4] + rel[4];
+    return ranks[0] + ranks[1] + ranks[2] + ranks[3] + super[4] + rel[4];
+}
+
+void IndexReader::setRank( uint8_t i, CharId rank, CharCount &ranks ) const
 {
     rank += charRanks[i];
+    if ( blocks_ )
+    {
+        setRankBlocked( rank, ranks );
+        return;
+    }
     CharId rankMark = rank / indexPerMark;
     CharId rankIndex = marks_[rankMark];
     
@@ -280,7 +341,7 @@ void IndexReader::setRank( uint8_t i, CharId rank, CharCount &ranks )
         while ( tmpTotal <= rank )
         {
             memcpy( &ranks.counts, &tmpRanks.counts, 32 );
-            memcpy( &ranks.endCounts, &tmpRanks.endCounts, 4 );
+            ranks.endCounts = tmpRanks.endCounts;
             totalCount = tmpTotal;
             ++rankIndex;
             if ( rank - totalCount < bwtPerIndex || rankIndex + 1 == indexSize ) break;
@@ -289,15 +350,10 @@ void IndexReader::setRank( uint8_t i, CharId rank, CharCount &ranks )
     }
     
     CharId rankBwt = rankIndex * bwtPerIndex;
-    CharId rankChunk = bwtPerIndex;
-    uint8_t offset = index_[(rankIndex * sizePerIndex)+36];
+    uint8_t offset = index_[(rankIndex * sizePerIndex)+sizePerIndex-1];
     rankBwt -= offset;
-    rankChunk += offset;
     CharId rankLeft = rank - totalCount;
-    if ( rankLeft < rankChunk ) rankChunk = rankLeft;
-    
-    fseek( bwt, rankBwt + beginBwt, SEEK_SET );
-    fread( buff, 1, rankChunk, bwt );
+    uint8_t* buff = bwt.data + beginBwt + rankBwt;
     
     uint8_t c;
     CharId p = 0, thisRun, addRun;
@@ -330,11 +386,60 @@ void IndexReader::setRank( uint8_t i, CharId rank, CharCount &ranks )
     }
 }
 
-CharId IndexReader::setRankIndex( CharId rankIndex, CharCount &ranks )
+void IndexReader::setRankBlocked( CharId rank, CharCount &ranks ) const
+{
+    // The mark gives the block holding the start of its span, so rank is at most a block or two on
+    CharId block = blockMarks_[ rank >> markShift ];
+    CharId totalCount = setBlockRank( block, ranks );
+    CharCount tmpRanks;
+    while ( block + 1 < blockCount )
+    {
+        CharId tmpTotal = setBlockRank( block + 1, tmpRanks );
+        if ( tmpTotal > rank ) break;
+        ranks = tmpRanks;
+        totalCount = tmpTotal;
+        ++block;
+    }
+    
+    uint8_t* buff = blocks_ + block * blockSize + 20;
+    CharId rankLeft = rank - totalCount;
+    CharId p = 0, thisRun, addRun;
+    uint8_t c;
+    
+    while ( rankLeft )
+    {
+        c = decodeBaseChar[ buff[p] ];
+        thisRun = decodeBaseRun[ buff[p] ];
+        if ( isBaseRun[ buff[p++] ] )
+        {
+            addRun = buff[p] & runMask;
+            uint8_t byteCount = 0;
+            while ( buff[p++] & runFlag )
+            {
+                addRun ^= ( buff[p] & runMask ) << ( 7 * ++byteCount );
+            }
+            thisRun += addRun;
+        }
+        
+        if ( thisRun > rankLeft ) thisRun = rankLeft;
+        if ( c == 4 )
+        {
+            ranks.endCounts += thisRun;
+        }
+        else
+        {
+            ranks.counts[c] += thisRun;
+        }
+        rankLeft -= thisRun;
+    }
+}
+
+CharId IndexReader::setRankIndex( CharId rankIndex, CharCount &ranks ) const
 {
     CharId indexBegin = rankIndex * sizePerIndex;
     memcpy( &ranks.counts, &index_[indexBegin], 32 );
-    memcpy( &ranks.endCounts, &index_[indexBegin+32], 4 );
+    ranks.endCounts = 0;
+    memcpy( &ranks.endCounts, &index_[indexBegin+32], sizePerIndex-33 );
     return ( ranks[0] + ranks[1] + ranks[2] + ranks[3] + ranks.endCounts );
 }
 
@@ -24,33 +24,37 @@
 #include "types.h"
 #include "filenames.h"
 #include "index_structs.h"
+#include "mapped_file.h"
 
 class IndexReader
 {
 public:
-    IndexReader( Filenames* fns );
+    IndexReader( Filenames* fns, bool preload=false );
     ~IndexReader();
     
-    void countRange( uint8_t i, CharId rank, CharId count, CharCount &ranks, CharCount &counts );
-    void countRange( uint8_t i, CharId rank, CharId edge, CharId count, CharCount &ranks, CharCount &edges, CharCount &counts );
-    void createSeeds( string &fn, int mer );
-    int primeOverlap( uint8_t* q, CharId &rank, CharId &count );
-    void primeOverlap( string &seq, vector<uint8_t> &q, CharId &rank, CharId &count, int &ol, bool drxn );
-    int setBaseAll( vector<uint8_t> &q, CharId &rank, CharId &count );
-    void setBaseAll( uint8_t i, uint8_t j, CharId &rank, CharId &count );
-    void setBaseAll( uint8_t i, uint8_t j, CharId &rank, CharId &edge, CharId &count );
-    ReadId setBaseMap( uint8_t i, uint8_t j, CharId &rank, CharId &count );
-    void setBaseOverlap( uint8_t i, uint8_t j, CharId &rank, CharId &count );
+    // Queries only read state fixed at construction, so one reader may be shared by many threads
+    void countRange( uint8_t i, CharId rank, CharId count, CharCount &ranks, CharCount &counts ) const;
+    void countRange( uint8_t i, CharId rank, CharId edge, CharId count, CharCount &ranks, CharCount &edges, CharCount &counts ) const;
+    void createSeeds( string &fn, int mer ) const;
+    int primeOverlap( uint8_t* q, CharId &rank, CharId &count ) const;
+    void primeOverlap( string &seq, vector<uint8_t> &q, CharId &rank, CharId &count, int &ol, bool drxn ) const;
+    int setBaseAll( vector<uint8_t> &q, CharId &rank, CharId &count ) const;
+    void setBaseAll( uint8_t i, uint8_t j, CharId &rank, CharId &count ) const;
+    void setBaseAll( uint8_t i, uint8_t j, CharId &rank, CharId &edge, CharId &count ) const;
+    ReadId setBaseMap( uint8_t i, uint8_t j, CharId &rank, CharId &count ) const;
+    void setBaseOverlap( uint8_t i, uint8_t j, CharId &rank, CharId &count ) const;
     
 private:
-    void advance( CharCount &ranks, CharId &bwtIndex, CharId &toCount );
-    void createSeeds( FILE* fp, int i, int it, int limit, CharId rank, CharId edge, CharId count );
-    void setRank( uint8_t i, CharId rank, CharCount &ranks );
-    CharId setRankIndex( CharId rankIndex, CharCount &ranks );
+    void createSeeds( FILE* fp, int i, int it, int limit, CharId rank, CharId edge, CharId count ) const;
+    CharId setBlockRank( CharId block, CharCount &ranks ) const;
+    void setBlocks( FILE* inBlk, CharId binId, bool preload );
+    void setRank( uint8_t i, CharId rank, CharCount &ranks ) const;
+    void setRankBlocked( CharId rank, CharCount &ranks ) const;
+    CharId setRankIndex( CharId rankIndex, CharCount &ranks ) const;
     
     
-    FILE* bwt;
-    uint8_t* buff,* mers;
+    MappedFile bwt;
+    uint8_t* mers;
     
     CharId bwtSize, indexSize, markSize;
     ReadId bwtPerIndex, indexPerMark;
@@ -60,7 +64,16 @@ private:
     
     // Index data
     uint8_t* index_;
-    ReadId* marks_;
+    uint32_t* marks_;
+    
+    // Blocked index data; each block holds counts relative to its superblock followed by its slice of the BWT
+    MappedFile blk;
+    uint8_t* blocks_;
+    CharId* supers_,* blockMarks_;
+    CharId blockCount;
+    uint32_t blocksPerSuper;
+    uint16_t blockSize;
+    uint8_t markShift;
     CharId charRanks[4], charCounts[5];
     CharId baseCounts[5][4], midRanks[4][4];
     
@@ -57,7 +57,7 @@ IndexWriter::IndexWriter( Filenames* fns )
     for ( int i ( 0 ); i < 4; i++ ) for ( int j ( 0 ); j < 63; j++ ) decodeBaseRun[ i * 63 + j ] = j + 1;
 }
 
-IndexWriter::IndexWriter( PreprocessFiles* fns, ReadId indexChunk, ReadId markChunk )
+IndexWriter::IndexWriter( PreprocessFiles* fns, ReadId indexChunk, ReadId markChunk, uint16_t blockSize )
 : bwtPerIndex( indexChunk ), countsPerMark( markChunk )
 {
     fns->setIndexWrite( bwt, idx );
@@ -73,7 +73,7 @@ IndexWriter::IndexWriter( PreprocessFiles* fns, ReadId indexChunk, ReadId markCh
     markSize = 1 + ( charCounts[0] + charCounts[1] + charCounts[2] + charCounts[3] + charCounts[4] ) / countsPerMark;
     
     buff = new uint8_t[IDX_BUFFER];
-    marks = new ReadId[ markSize ];
+    marks = new uint32_t[ markSize ];
     
     currByte = 0;
     memset( &counts, 0, 40 );
@@ -94,6 +94,8 @@ IndexWriter::IndexWriter( PreprocessFiles* fns, ReadId indexChunk, ReadId markCh
     }
     
     writeIndex();
+    if ( blockSize ) writeBlocks( fns, blockSize );
+    else if ( Filenames::exists( fns->blk ) ) fns->removeFile( fns->blk );
     fclose( bwt );
     fclose( idx );
 //    writeMers( fns );
@@ -160,6 +162,144 @@ void IndexWriter::testBwt()
     cout << "$: " << counts[4] << endl;
 }
 
+static CharId maxBlockRun( uint8_t c, uint16_t bytes )
+{
+    CharId maxBase = c < 4 ? 62 : 3;
+    return bytes > 1 ? maxBase + ( (CharId)1 << ( 7 * ( bytes - 1 ) ) ) : maxBase;
+}
+
+static uint8_t writeBlockRun( uint8_t* out, uint8_t c, CharId run )
+{
+    // Same run encoding as the final BWT, so blocks decode with the same tables
+    uint8_t maxBase = c < 4 ? 62 : 3, baseBit = c < 4 ? 63 * c : 252, n = 0;
+    CharId lastRun = run - 1;
+    if ( lastRun < maxBase )
+    {
+        out[n++] = baseBit + lastRun;
+        return n;
+    }
+    out[n++] = baseBit + maxBase;
+    lastRun -= maxBase;
+    while ( lastRun >= 128 )
+    {
+        out[n++] = 128 ^ ( lastRun & 127 );
+        lastRun >>= 7;
+    }
+    out[n++] = lastRun;
+    return n;
+}
+
+void IndexWriter::writeBlocks( PreprocessFiles* fns, uint16_t blockSize )
+{
+    double blockStartTime = clock();
+    FILE* blk;
+    fns->setBlocksWrite( blk );
+    
+    // Space marks at a power of two near the number of symbols expected per block
+    CharId totalCount = charCounts[0] + charCounts[1] + charCounts[2] + charCounts[3] + charCounts[4];
+    CharId perBlock = max( (CharId)1, ( totalCount * ( blockSize - 20 ) ) / max( (CharId)1, bwtSize ) );
+    uint8_t markShift = 0;
+    while ( ( (CharId)1 << markShift ) < perBlock ) markShift++;
+    
+    uint8_t blkBegin = BLK_BEGIN, pad[BLK_BEGIN]{0};
+    uint32_t blocksPerSuper = BLK_PER_SUPER;
+    CharId blockCount = 0, superCount = 0, markCount = ( totalCount >> markShift ) + 1;
+    fwrite( &blkBegin, 1, 1, blk );
+    fwrite( &id, 8, 1, blk );
+    fwrite( &blockSize, 2, 1, blk );
+    fwrite( &blocksPerSuper, 4, 1, blk );
+    fwrite( &markShift, 1, 1, blk );
+    fwrite( &blockCount, 8, 1, blk );           // Dummy block count
+    fwrite( &superCount, 8, 1, blk );           // Dummy superblock count
+    fwrite( &markCount, 8, 1, blk );
+    fwrite( &charCounts, 8, 5, blk );
+    fwrite( pad, 1, BLK_BEGIN - ftell( blk ), blk );
+    
+    vector<CharId> supers, blockMarks;
+    uint8_t block[blockSize];
+    CharId runCounts[5]{0}, superCounts[5]{0}, currRank = 0;
+    uint16_t p = blockSize;
+    
+    uint8_t currChar;
+    uint8_t currRunBytes = 0;
+    CharId currRun, currAddRun;
+    bool startByte = true;
+    ReadId pBuff = IDX_BUFFER - 1;
+    
+    fseek( bwt, bwtBegin, SEEK_SET );
+    CharId bwtLeft = bwtSize + 1;
+    while ( --bwtLeft )
+    {
+        if ( ++pBuff == IDX_BUFFER )
+        {
+            fread( buff, 1, min( bwtLeft, IDX_BUFFER ), bwt );
+            pBuff = 0;
+        }
+        
+        if ( startByte )
+        {
+            currChar = decodeBaseChar[ buff[pBuff] ];
+            currRun = decodeBaseRun[ buff[pBuff] ];
+            currRunBytes = 0;
+            currAddRun = 0;
+            startByte = currRun != maxBaseRun[currChar];
+        }
+        else
+        {
+            currAddRun ^= ( ( buff[pBuff] & contMask ) << ( 7 * currRunBytes++ ) );
+            startByte = !( buff[pBuff] & contFlag );
+        }
+        
+        if ( !startByte ) continue;
+        
+        // Runs are split at block boundaries so that every block decodes on its own
+        currRun += currAddRun;
+        while ( currRun )
+        {
+            if ( p == blockSize )
+            {
+                if ( blockCount ) fwrite( block, 1, blockSize, blk );
+                if ( !( blockCount % blocksPerSuper ) )
+                {
+                    memcpy( &superCounts, &runCounts, 40 );
+                    supers.insert( supers.end(), runCounts, runCounts + 5 );
+                }
+                while ( blockMarks.size() < markCount && ( (CharId)blockMarks.size() << markShift ) < currRank )
+                {
+                    blockMarks.push_back( blockCount - 1 );
+                }
+                memset( block, 0, blockSize );
+                for ( int i = 0; i < 5; i++ )
+                {
+                    uint32_t relCount = runCounts[i] - superCounts[i];
+                    memcpy( &block[i*4], &relCount, 4 );
+                }
+                ++blockCount;
+                p = 20;
+            }
+            
+            CharId piece = min( currRun, maxBlockRun( currChar, min( blockSize - p, BLK_MAX_RUN_BYTES ) ) );
+            p += writeBlockRun( &block[p], currChar, piece );
+            runCounts[currChar] += piece;
+            currRank += piece;
+            currRun -= piece;
+        }
+    }
+    
+    if ( blockCount ) fwrite( block, 1, blockSize, blk );
+    while ( blockMarks.size() < markCount ) blockMarks.push_back( blockCount - 1 );
+    superCount = supers.size() / 5;
+    fwrite( &supers[0], 8, supers.size(), blk );
+    fwrite( &blockMarks[0], 8, markCount, blk );
+    fseek( blk, 16, SEEK_SET );
+    fwrite( &blockCount, 8, 1, blk );
+    fwrite( &superCount, 8, 1, blk );
+    fclose( blk );
+    
+    cout << "Created " << to_string( blockCount ) << " rank blocks of " << to_string( blockSize ) << " bytes" << endl;
+    cout << "Time taken: " << getDuration( blockStartTime ) << endl;
+}
+
 void IndexWriter::writeIndex()
 {
     double indexStartTime = clock();
@@ -181,10 +321,13 @@ void IndexWriter::writeIndex()
     CharId markCount = 0;
     bool startByte = true;
     ReadId p = IDX_BUFFER - 1;
-    ReadId endCount = counts[4];
+    
+    // End counts take 4 bytes per index point unless there are too many ends for them
+    uint8_t endBytes = charCounts[4] < UINT32_MAX ? 4 : 8;
+    CharId endCount = counts[4];
     
     fwrite( &counts, 8, 4, idx );
-    fwrite( &endCount, 4, 1, idx );
+    fwrite( &endCount, endBytes, 1, idx );
     fwrite( &currRunBytes, 1, 1, idx );         // Dummy offset
     
     CharId bwtLeft = bwtSize + 1;
@@ -217,7 +360,7 @@ void IndexWriter::writeIndex()
                 currRunBytes -= ( currChunkBytes - bwtPerIndex );
                 endCount = counts[4];
                 fwrite( &counts, 8, 4, idx );
-                fwrite( &endCount, 4, 1, idx );
+                fwrite( &endCount, endBytes, 1, idx );
                 fwrite( &currRunBytes, 1, 1, idx );
                 currChunkBytes -= bwtPerIndex;
                 
@@ -22,6 +22,9 @@
 #define INDEX_WRITER_H
 
 #define IDX_BUFFER (CharId)16384
+#define BLK_BEGIN 128
+#define BLK_PER_SUPER 1024
+#define BLK_MAX_RUN_BYTES 3
 
 #include "filenames.h"
 #include "types.h"
@@ -29,7 +32,7 @@
 class IndexWriter
 {
 public:
-    IndexWriter( PreprocessFiles* fns, ReadId indexChunk, ReadId markChunk );
+    IndexWriter( PreprocessFiles* fns, ReadId indexChunk, ReadId markChunk, uint16_t blockSize=0 );
     virtual ~IndexWriter();
     static void test( Filenames* fns );
     static void write( PreprocessFiles* fns, ReadId indexChunk, ReadId markChunk );
@@ -37,6 +40,7 @@ public:
 private:
     IndexWriter( Filenames* fns );
     void testBwt();
+    void writeBlocks( PreprocessFiles* fns, uint16_t blockSize );
     void writeIndex();
     void writeMers( PreprocessFiles* fns );
     
@@ -44,7 +48,7 @@ private:
     CharId id;
     
     uint8_t* buff;
-    ReadId* marks;
+    uint32_t* marks;
     
     uint8_t decodeBaseChar[256], decodeBaseRun[256], maxBaseRun[5];
     uint8_t contFlag, contMask;
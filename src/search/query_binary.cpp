@@ -20,12 +20,30 @@
 
 #include "query_binary.h"
 #include "parameters.h"
+#include "shared_functions.h"
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <string.h>
+#include <unistd.h>
 
 extern Parameters params;
 
+// Reads at random from the sequence or ids files, which must hold every byte asked for
+static void readFully( FILE* fp, void* buf, size_t len, CharId offset )
+{
+    for ( size_t got = 0; got < len; )
+    {
+        ssize_t n = pread( fileno( fp ), (uint8_t*)buf + got, len - got, offset + got );
+        if ( n <= 0 )
+        {
+            cerr << endl << "Error: input data files appear either incomplete or corrupted." << endl;
+            exit( EXIT_FAILURE );
+        }
+        got += n;
+    }
+}
+
 QueryBinaries::QueryBinaries( Filenames* fns )
 {
     bin_ = fns->getBinary( true, false );
@@ -36,34 +54,47 @@ QueryBinaries::QueryBinaries( Filenames* fns )
     fread( &binId, 8, 1, bin_ );
     fread( &idsBegin_, 1, 1, ids_ );
     fread( &idsId, 8, 1, ids_ );
+    idBytes_ = 4;
+    if ( idsBegin_ > 9 ) fread( &idBytes_, 1, 1, ids_ );
+    if ( idBytes_ > sizeof( ReadId ) )
+    {
+        cerr << endl << "Error: these reads were indexed with 64-bit read ids. Rebuild with \"make WIDE_IDS=1\" to read them." << endl;
+        exit( EXIT_FAILURE );
+    }
     if ( binId != idsId )
     {
         cerr << endl << "Error: disagreement among input files." << endl;
         exit( EXIT_FAILURE );
     }
     
-    uint8_t libCount, readLen, cycles;
+    uint8_t libCount;
+    uint16_t readLen, cycles;
     uint32_t coverage;
-    fread( &readLen, 1, 1, bin_ );
-    fread( &cycles, 1, 1, bin_ );
+    readBinaryLength( bin_, binBegin_, readLen, cycles );
     params.readLen = readLen;
-    lineLen_ = 1 + ( readLen + 3 ) / 4;
+    lenBytes_ = readLen > 255 ? 2 : 1;
+    lineLen_ = lenBytes_ + ( readLen + 3 ) / 4;
     if ( cycles != readLen + 1 )
     {
         cerr << endl << "Error: input data files appear either incomplete or corrupted." << endl;
         exit( EXIT_FAILURE );
     }
+    fseek( bin_, 11, SEEK_SET );
     fread( &params.isCalibrated, 1, 1, bin_ );
     fread( &coverage, 4, 1, bin_ );
     params.cover = (float)coverage / (float)100000;
-    fread( &params.seqCount, 4, 1, bin_ );
+    fseek( bin_, 20, SEEK_SET );
     fread( &libCount, 1, 1, bin_ );
+    CharId wideBegin = 21 + libCount * 12;
+    fseek( bin_, 16, SEEK_SET );
+    params.seqCount = readBinaryCount( bin_, wideBegin );
+    fseek( bin_, 21, SEEK_SET );
     ReadId countSoFar = 0;
     for ( int i ( 0 ); i < libCount; i++ )
     {
         Lib lib;
         uint16_t libMed, libMin, libMax;
-        fread( &lib.count, 4, 1, bin_ );
+        lib.count = readBinaryCount( bin_, wideBegin + 8 * ( i + 1 ) );
         fread( &libMed, 2, 1, bin_ );
         fread( &libMin, 2, 1, bin_ );
         fread( &libMax, 2, 1, bin_ );
@@ -79,60 +110,94 @@ QueryBinaries::QueryBinaries( Filenames* fns )
     
     params.set();
     set();
+    setDupes( fns, binId );
 }
 
 
-void QueryBinaries::decodeSequence( uint8_t* line, string &seq, uint8_t extLen, bool isRev, bool drxn )
+void QueryBinaries::decodeSequence( uint8_t* line, string &seq, uint16_t extLen, bool isRev, bool drxn ) const
 {
+    uint16_t len = lenBytes_ > 1 ? line[0] | ( line[1] << 8 ) : line[0];
+    uint8_t* bases = line + lenBytes_;
     if ( isRev )
     {
-        uint8_t i = drxn ? extLen : line[0];
-        uint8_t j = drxn ? 0 : line[0] - extLen;
+        uint16_t i = drxn ? extLen : len;
+        uint16_t j = drxn ? 0 : len - extLen;
         while ( i -- > j )
         {
-            seq += decodeRev[ i & 0x3 ][ line[ 1 + ( i / 4 ) ] ];
+            seq += decodeRev[ i & 0x3 ][ bases[ i / 4 ] ];
         }
     }
     else
     {
-        uint8_t i = drxn ? line[0] - extLen : 0;
-        uint8_t j = drxn ? line[0] : extLen;
+        uint16_t i = drxn ? len - extLen : 0;
+        uint16_t j = drxn ? len : extLen;
         while ( i < j )
         {
-            seq += decodeFwd[ i & 0x3 ][ line[ 1 + ( i / 4 ) ] ];
+            seq += decodeFwd[ i & 0x3 ][ bases[ i / 4 ] ];
             ++i;
         }
     }
 }
 
 
-string QueryBinaries::getSequence( ReadId id )
+string QueryBinaries::getSequence( ReadId id ) const
 {
     bool isRev = id & 0x1;
     string seq;
     uint8_t line[lineLen_];
     CharId seekId = CharId( id / 2 ) * lineLen_ + binBegin_;
-    fseek( bin_, seekId, SEEK_SET );
-    fread( &line, 1, lineLen_, bin_ );
-    decodeSequence( line, seq, line[0], isRev, 1 );
+    readFully( bin_, &line, lineLen_, seekId );
+    decodeSequence( line, seq, lenBytes_ > 1 ? line[0] | ( line[1] << 8 ) : line[0], isRev, 1 );
     return seq;
 }
 
-vector<ReadId> QueryBinaries::getIds( CharId rank, CharId count )
+ReadId QueryBinaries::getMultiplicity( ReadId id ) const
+{
+    auto it = lower_bound( dupLines_.begin(), dupLines_.end(), id / 2 );
+    return it != dupLines_.end() && *it == id / 2 ? dupCounts_[ it - dupLines_.begin() ] : 1;
+}
+
+vector<ReadId> QueryBinaries::getIds( CharId rank, CharId count ) const
 {
     vector<ReadId> readIds( count );
-    ReadId idBuff[count];
-    CharId seekId = rank * 4 + idsBegin_;
-    fseek( ids_, seekId, SEEK_SET );
-    fread( &idBuff, 4, count, ids_ );
-    for ( int i ( 0 ); i < count; i++ )
+    CharId seekId = rank * idBytes_ + idsBegin_;
+    if ( count && idBytes_ == sizeof( ReadId ) ) readFully( ids_, &readIds[0], count * idBytes_, seekId );
+    else if ( count )
     {
-        readIds[i] = idBuff[i];
+        // 32-bit ids read into a WIDE_IDS build are widened in place, from the back
+        readFully( ids_, &readIds[0], count * idBytes_, seekId );
+        uint32_t* narrow = (uint32_t*)&readIds[0];
+        for ( CharId i = count; i--; ) readIds[i] = narrow[i];
     }
     return readIds;
 }
 
 
+void QueryBinaries::setDupes( Filenames* fns, uint64_t binId )
+{
+    // Reads indexed without collapsing duplicates have no multiplicity table
+    FILE* dup = fns->getReadPointer( fns->dup, false, true );
+    if ( !dup ) return;
+    uint64_t dupId, line = 0;
+    uint8_t dupBegin, lineBytes;
+    uint32_t count;
+    fread( &dupBegin, 1, 1, dup );
+    fread( &dupId, 8, 1, dup );
+    fread( &lineBytes, 1, 1, dup );
+    if ( dupId != binId )
+    {
+        cerr << endl << "Error: disagreement among input files." << endl;
+        exit( EXIT_FAILURE );
+    }
+    fseek( dup, dupBegin, SEEK_SET );
+    while ( fread( &line, lineBytes, 1, dup ) && fread( &count, 4, 1, dup ) )
+    {
+        dupLines_.push_back( line );
+        dupCounts_.push_back( count );
+    }
+    fclose( dup );
+}
+
 void QueryBinaries::set()
 {
     for ( int i ( 0 ); i < 256; i++ )
@@ -29,15 +29,23 @@ class QueryBinaries
 public:
     QueryBinaries( Filenames* fns );
     ~QueryBinaries(){};
-    vector<ReadId> getIds( CharId ranks, CharId counts );
-    string getSequence( ReadId id );
+    // Lookups use positioned reads on the shared handles, so they are safe to call from several threads
+    vector<ReadId> getIds( CharId ranks, CharId counts ) const;
+    ReadId getMultiplicity( ReadId id ) const;
+    string getSequence( ReadId id ) const;
     
 private:
-    void decodeSequence( uint8_t* line, string &seq, uint8_t extLen, bool isRev, bool drxn );
+    void decodeSequence( uint8_t* line, string &seq, uint16_t extLen, bool isRev, bool drxn ) const;
     void set();
+    void setDupes( Filenames* fns, uint64_t binId );
     
     FILE* bin_,* ids_;
-    uint8_t binBegin_, idsBegin_, lineLen_;
+    uint8_t binBegin_, idsBegin_, idBytes_, lenBytes_;
+    uint16_t lineLen_;
+    
+    // Lines kept for collapsed duplicates, in order, with how many copies each stands for
+    vector<ReadId> dupLines_;
+    vector<uint32_t> dupCounts_;
     
     char decodeFwd[4][256];
     char decodeRev[4][256];
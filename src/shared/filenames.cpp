@@ -24,7 +24,7 @@
 #include <sys/stat.h>
 
 Filenames::Filenames( string inPrefix )
-: prefix( inPrefix )
+: prefix( inPrefix ), mem( NULL ), scratch( NULL )
 {
     string folder = inPrefix.substr( 0, inPrefix.find_last_of( '/' ) );
     makeFolder( folder );
@@ -33,7 +33,9 @@ Filenames::Filenames( string inPrefix )
     bwt = prefix + "-bwt.dat";
     ids = prefix + "-ids.dat";
     idx = prefix + "-idx.dat";
+    blk = prefix + "-blk.dat";
     mer = prefix + "-mer.dat";
+    dup = prefix + "-dup.dat";
 }
 
 bool Filenames::exists( string &filename )
@@ -45,8 +47,25 @@ bool Filenames::exists( string &filename )
     return result;
 }
 
+FILE* Filenames::getEditPointer( string &filename )
+{
+    // Reuse an existing file in place where possible, otherwise create it
+    if ( mem ) if ( FILE* fp = mem->open( filename, 'c' ) ) return fp;
+    if ( scratch ) if ( FILE* fp = scratch->open( filename, 'c' ) ) return fp;
+    FILE* fp = fopen( filename.c_str(), "rb+" );
+    if ( fp == NULL ) fp = fopen( filename.c_str(), "wb+" );
+    if ( fp == NULL )
+    {
+        cerr << "Error opening file \"" << filename << "\"." << endl;
+        exit( EXIT_FAILURE );
+    }
+    return fp;
+}
+
 FILE* Filenames::getReadPointer( string &filename, bool doEdit, bool allowFail )
 {
+    if ( mem ) if ( FILE* fp = mem->open( filename, doEdit ? 'e' : 'r' ) ) return fp;
+    if ( scratch ) if ( FILE* fp = scratch->open( filename, doEdit ? 'e' : 'r' ) ) return fp;
     FILE* fp = fopen( filename.c_str(), ( doEdit ? "rb+" : "rb" ) );
     if ( fp == NULL && !allowFail )
     {
@@ -58,6 +77,8 @@ FILE* Filenames::getReadPointer( string &filename, bool doEdit, bool allowFail )
 
 FILE* Filenames::getWritePointer( string &filename )
 {
+    if ( mem ) if ( FILE* fp = mem->open( filename, 'w' ) ) return fp;
+    if ( scratch ) if ( FILE* fp = scratch->open( filename, 'w' ) ) return fp;
     FILE* fp = fopen( filename.c_str(), "wb" );
     if ( fp == NULL )
     {
@@ -120,43 +141,35 @@ void Filenames::makeFolder( string folder )
     }
 }
 
-void Filenames::removeFile( string &filename )
+void Filenames::removeFile( string &filename, bool allowMissing )
 {
+    // Files held in memory, spilt or held in scratch files need only be released, though an older copy may remain on disk
+    bool released = ( mem && mem->release( filename ) ) || ( scratch && scratch->release( filename ) );
+    if ( ( released || allowMissing ) && !exists( filename ) ) return;
     if ( remove( filename.c_str() ) )
     {
         cerr << "Warning: could not remove file \"" << filename << "\"" << endl;
     }
 }
 
-void Filenames::setIndex( FILE* &inBin, FILE* &inBwt, FILE* &inIdx, FILE* &inMer )
+void Filenames::setIndex( FILE* &inBin, FILE* &inBwt, FILE* &inIdx, FILE* &inBlk, FILE* &inMer )
 {
     inBin = getReadPointer( bin, false );
     inBwt = getReadPointer( bwt, false );
     inIdx = getReadPointer( idx, false );
+    inBlk = getReadPointer( blk, false, true );
     inMer = getReadPointer( mer, false, true );
 }
 
 PreprocessFiles::PreprocessFiles( string inPrefix, bool overwrite )
-: Filenames( inPrefix )
+: Filenames( inPrefix ), memBudget( 0 )
 {
-    tmpSingles = prefix + "-tmpSingles.seq";
+    tmpSingles = prefix + "-tmpSingles.bin";
     tmpChr = prefix + "-chr.dat";
     tmpTrm = prefix + "-trm.dat";
-    for ( int i( 0 ); i < 2; i++ )
-    {
-        tmpBwt[i] = prefix + "-bwt-tmp" + to_string( i + 1 );
-        tmpEnd[i] = prefix + "-end-tmp" + to_string( i + 1 );
-        for ( int j( 0 ); j < 4; j++ )
-        {
-            tmpIns[i][j] = prefix + "-ins-" + to_string( j + 1 ) + "-tmp" + to_string( i + 1 );
-            for ( int k( 0 ); k < 5; k++ )
-            {
-                tmpIds[i][j][k] = prefix + "-ids-" + to_string( j + 1 ) + to_string( k + 1 ) + "-tmp" + to_string( i + 1 );
-            }
-        }
-    }
+    setTmpDirs( vector<string>() );
     
-    for ( string const &fn : { bwt, bin, ids, idx, mer } )
+    for ( string const &fn : { bwt, bin, ids, idx, blk, mer, dup } )
     {
         if ( ifstream( fn ) && !overwrite )
         {
@@ -166,119 +179,134 @@ PreprocessFiles::PreprocessFiles( string inPrefix, bool overwrite )
     }
 }
 
-void PreprocessFiles::clean()
+void PreprocessFiles::clean( bool allowMissing )
 {
-    removeFile( tmpSingles );
-    removeFile( tmpChr );
-    removeFile( tmpTrm );
+    // Copies spilt by a session that held its files in memory may remain
+    auto removeTmp = [&]( string &filename ){
+        string spill = filename + "-spill";
+        if ( !mem && exists( spill ) ) removeFile( spill );
+        removeFile( filename, allowMissing );
+    };
+    
+    removeFile( tmpSingles, true );
+    removeFile( tmpChr, allowMissing );
+    removeFile( tmpTrm, allowMissing );
     for ( int i( 0 ); i < 2; i++ )
     {
-        removeFile( tmpBwt[i] );
-        removeFile( tmpEnd[i] );
+        for ( int s( 0 ); s < 4; s++ )
+        {
+            removeTmp( tmpBwt[i][s] );
+            removeTmp( tmpEnd[i][s] );
+        }
         for ( int j( 0 ); j < 4; j++ )
         {
-            removeFile( tmpIns[i][j] );
-            for ( int k( 0 ); k < 5; k++ )
+            for ( int s( 0 ); s < 4; s++ )
             {
-                removeFile( tmpIds[i][j][k] );
+                removeTmp( tmpIns[i][j][s] );
+                for ( int k( 0 ); k < 5; k++ )
+                {
+                    removeTmp( tmpIds[i][j][k][s] );
+                }
             }
         }
     }
+    
+    if ( scratch ) scratch->clean();
+}
+
+PreprocessFiles* PreprocessFiles::getChunk( int chunk, int chunkCount )
+{
+    // Each chunk keeps its files beside these, in the same temporary directories and with an even share of any memory budget
+    PreprocessFiles* fns = new PreprocessFiles( prefix + "-chunk" + to_string( chunk + 1 ), true );
+    if ( !tmpDirs.empty() ) fns->setTmpDirs( tmpDirs );
+    if ( scratch ) fns->setScratch();
+    if ( mem ) fns->setMemory( memBudget / chunkCount );
+    return fns;
 }
 
 void PreprocessFiles::setBinaryWrite( FILE* &outBin, FILE* &outBwt, FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5] )
 {
     outBin = getWritePointer( bin );
-    outBwt = getWritePointer( tmpBwt[0] );
-    outEnd = getWritePointer( tmpEnd[0] );
+    outBwt = getWritePointer( tmpBwt[0][0] );
+    outEnd = getWritePointer( tmpEnd[0][0] );
     for ( int i ( 0 ); i < 4; i++ )
     {
-        outIns[i] = getWritePointer( tmpIns[0][i] );
+        outIns[i] = getWritePointer( tmpIns[0][i][0] );
         for ( int j ( 0 ); j < 5; j++ )
         {
-            outIds[i][j] = getWritePointer( tmpIds[0][i][j] );
+            outIds[i][j] = getWritePointer( tmpIds[0][i][j][0] );
         }
     }
 }
 
-void PreprocessFiles::setCycler( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5], uint8_t cycle )
+void PreprocessFiles::setBlocksWrite( FILE* &outBlk )
+{
+    outBlk = getWritePointer( blk );
+}
+
+void PreprocessFiles::setCycler( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5], uint16_t cycle, uint8_t i )
 {
     uint8_t iIn = cycle & 1;
     
-    inBwt = getReadPointer( tmpBwt[iIn], false );
-    outBwt = getWritePointer( tmpBwt[!iIn] );
-    inEnd = getReadPointer( tmpEnd[iIn], false );
-    outEnd = getWritePointer( tmpEnd[!iIn] );
-    for ( int i ( 0 ); i < 4; i++ )
+    inBwt = getReadPointer( tmpBwt[iIn][i], false );
+    outBwt = getWritePointer( tmpBwt[!iIn][i] );
+    inEnd = getReadPointer( tmpEnd[iIn][i], false );
+    outEnd = getWritePointer( tmpEnd[!iIn][i] );
+    for ( int j ( 0 ); j < 4; j++ )
     {
-        outIns[i] = getReadPointer( tmpIns[!iIn][i], true );
-        for ( int j ( 0 ); j < 5; j++ )
+        outIns[j] = getEditPointer( tmpIns[!iIn][j][i] );
+        for ( int k ( 0 ); k < 5; k++ )
         {
-            outIds[i][j] = getReadPointer( tmpIds[!iIn][i][j], true );
+            outIds[j][k] = getEditPointer( tmpIds[!iIn][j][k][i] );
         }
     }
 }
 
-//void PreprocessFiles::setCycler( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5], uint8_t cycle )
-//{
-//    uint8_t iIn = cycle & 1;
-//    
-//    inBwt = getReadPointer( tmpBwt[iIn], false );
-//    outBwt = getWritePointer( tmpBwt[!iIn] );
-//    inEnd = getReadPointer( tmpEnd[iIn], false );
-//    outEnd = getWritePointer( tmpEnd[!iIn] );
-//    for ( int i ( 0 ); i < 4; i++ )
-//    {
-//        outIns[i] = getWritePointer( tmpIns[!iIn][i] );
-//        for ( int j ( 0 ); j < 5; j++ )
-//        {
-//            outIds[i][j] = getWritePointer( tmpIds[!iIn][i][j] );
-//        }
-//    }
-//}
-
-void PreprocessFiles::setCyclerIter( FILE* &inIns, FILE* (&inIds)[5], uint8_t cycle, uint8_t i )
+void PreprocessFiles::setCyclerIter( FILE* &inIns, FILE* (&inIds)[5], uint16_t cycle, uint8_t i, uint8_t seg )
 {
     uint8_t iIn = cycle & 1;
     
-    inIns = getReadPointer( tmpIns[iIn][i], false );
+    inIns = getReadPointer( tmpIns[iIn][i][seg], false );
     for ( int j ( 0 ); j < 5; j++ )
     {
-        inIds[j] = getReadPointer( tmpIds[iIn][i][j], false );
+        inIds[j] = getReadPointer( tmpIds[iIn][i][j][seg], false );
     }
 }
 
-void PreprocessFiles::setCyclerFinal( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, uint8_t cycle )
+void PreprocessFiles::setCyclerFinal( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, uint16_t cycle, uint8_t i )
 {
     uint8_t iIn = cycle & 1;
     
-    inBwt = getReadPointer( tmpBwt[iIn], false );
-    outBwt = getWritePointer( bwt );
-    inEnd = getReadPointer( tmpEnd[iIn], false );
-    outEnd = getWritePointer( ids );
+    // The first bucket writes straight to the outputs; the rest are appended to it once done
+    inBwt = getReadPointer( tmpBwt[iIn][i], false );
+    outBwt = getWritePointer( i ? tmpBwt[!iIn][i] : bwt );
+    inEnd = getReadPointer( tmpEnd[iIn][i], false );
+    outEnd = getWritePointer( i ? tmpEnd[!iIn][i] : ids );
 }
 
-void PreprocessFiles::setCyclerFinalIter( FILE* &inIns, FILE* &inIds, uint8_t cycle, uint8_t i )
+void PreprocessFiles::setCyclerFinalIter( FILE* &inIns, FILE* &inIds, uint16_t cycle, uint8_t i, uint8_t seg )
 {
     uint8_t iIn = cycle & 1;
     
-    inIns = getReadPointer( tmpIns[iIn][i], false );
-    inIds = getReadPointer( tmpIds[iIn][i][4], false );
+    inIns = getReadPointer( tmpIns[iIn][i][seg], false );
+    inIds = getReadPointer( tmpIds[iIn][i][4][seg], false );
 }
 
-void PreprocessFiles::setCyclerUpdate( FILE* &outBwt, FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5], uint8_t cycle )
+void PreprocessFiles::setCyclerMerge( FILE* &inBwt, FILE* &inEnd, uint16_t cycle, uint8_t i )
+{
+    uint8_t iIn = cycle & 1;
+    
+    inBwt = getReadPointer( tmpBwt[!iIn][i], false );
+    inEnd = getReadPointer( tmpEnd[!iIn][i], false );
+}
+
+void PreprocessFiles::setCyclerSizes( FILE* (&inBwts)[4], uint16_t cycle )
 {
     uint8_t iIn = cycle & 1;
     
-    outBwt = getReadPointer( tmpBwt[!iIn], true );
-    outEnd = getReadPointer( tmpEnd[!iIn], true );
     for ( int i ( 0 ); i < 4; i++ )
     {
-        outIns[i] = getReadPointer( tmpIns[!iIn][i], true );
-        for ( int j ( 0 ); j < 5; j++ )
-        {
-            outIds[i][j] = getReadPointer( tmpIds[!iIn][i][j], true );
-        }
+        inBwts[i] = getReadPointer( tmpBwt[iIn][i], false );
     }
 }
 
@@ -288,7 +316,97 @@ void PreprocessFiles::setIndexWrite( FILE* &inBwt, FILE* &outIdx )
     outIdx = getWritePointer( idx );
 }
 
+void PreprocessFiles::setMemory( CharId budget )
+{
+    // Only the files rewritten every cycle are held in memory
+    memBudget = budget;
+    mem = new MemoryFiles( budget );
+    for ( int s( 0 ); s < 4; s++ )
+    {
+        mem->add( tmpBwt[0][s], tmpBwt[1][s] );
+        mem->add( tmpEnd[0][s], tmpEnd[1][s] );
+        for ( int j( 0 ); j < 4; j++ )
+        {
+            mem->add( tmpIns[0][j][s], tmpIns[1][j][s] );
+            for ( int k( 0 ); k < 5; k++ )
+            {
+                mem->add( tmpIds[0][j][k][s], tmpIds[1][j][k][s] );
+            }
+        }
+    }
+}
+
 void PreprocessFiles::setMersWrite( FILE* &outMer )
 {
     outMer = getWritePointer( mer );
 }
+
+void PreprocessFiles::setScratch()
+{
+    // Each generation in each directory shares one scratch file
+    string name = prefix.substr( prefix.find_last_of( '/' ) + 1 );
+    scratch = new ScratchFiles();
+    auto add = [&]( string &filename, int i ){
+        string scratchname = filename.substr( 0, filename.find_last_of( '/' ) + 1 ) + name + "-scratch-tmp" + to_string( i + 1 );
+        scratch->add( filename, scratchname );
+    };
+    for ( int i( 0 ); i < 2; i++ )
+    {
+        for ( int s( 0 ); s < 4; s++ )
+        {
+            add( tmpBwt[i][s], i );
+            add( tmpEnd[i][s], i );
+        }
+        for ( int j( 0 ); j < 4; j++ )
+        {
+            for ( int s( 0 ); s < 4; s++ )
+            {
+                add( tmpIns[i][j][s], i );
+                for ( int k( 0 ); k < 5; k++ )
+                {
+                    add( tmpIds[i][j][k][s], i );
+                }
+            }
+        }
+    }
+}
+
+void PreprocessFiles::setTmpDirs( vector<string> dirs )
+{
+    // Every bucket reads the segments of all four, so each generation keeps to its own directories, the even or odd ones, which its buckets take in turn
+    // A cycle thus never reads and writes the same directory where there are two or more; an odd count leaves the first generation one more
+    string name = prefix.substr( prefix.find_last_of( '/' ) + 1 );
+    string base[2][4];
+    tmpDirs = dirs;
+    for ( int i( 0 ); i < 2; i++ )
+    {
+        size_t shared = ( dirs.size() + 1 - i ) / 2;
+        for ( int s( 0 ); s < 4; s++ )
+        {
+            if ( dirs.empty() ) base[i][s] = prefix;
+            else if ( !shared ) base[i][s] = dirs[0] + "/" + name;
+            else base[i][s] = dirs[ i + 2 * ( s % shared ) ] + "/" + name;
+        }
+    }
+    for ( string &dir : dirs ) makeFolder( dir );
+    
+    for ( int i( 0 ); i < 2; i++ )
+    {
+        for ( int s( 0 ); s < 4; s++ )
+        {
+            tmpBwt[i][s] = base[i][s] + "-bwt-" + to_string( s + 1 ) + "-tmp" + to_string( i + 1 );
+            tmpEnd[i][s] = base[i][s] + "-end-" + to_string( s + 1 ) + "-tmp" + to_string( i + 1 );
+        }
+        for ( int j( 0 ); j < 4; j++ )
+        {
+            for ( int s( 0 ); s < 4; s++ )
+            {
+                tmpIns[i][j][s] = base[i][s] + "-ins-" + to_string( j + 1 ) + to_string( s + 1 ) + "-tmp" + to_string( i + 1 );
+                for ( int k( 0 ); k < 5; k++ )
+                {
+                    tmpIds[i][j][k][s] = base[i][s] + "-ids-" + to_string( j + 1 ) + to_string( k + 1 ) + to_string( s + 1 ) + "-tmp" + to_string( i + 1 );
+                }
+            }
+        }
+    }
+}
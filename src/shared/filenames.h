@@ -22,6 +22,8 @@
 #define FILENAMES_H
 
 #include "types.h"
+#include "memory_files.h"
+#include "scratch_files.h"
 #include <fstream>
 
 struct Filenames
@@ -30,6 +32,7 @@ struct Filenames
     
     static bool exists( string &filename );
     
+    FILE* getEditPointer( string &filename );
     FILE* getReadPointer( string &filename, bool doEdit, bool allowFail=false );
     FILE* getWritePointer( string &filename );
     ifstream getReadStream( string &filename );
@@ -38,38 +41,56 @@ struct Filenames
     FILE* getBinary( bool doRead, bool doEdit );
     bool isFolder( string folder );
     void makeFolder( string folder );
-    void removeFile( string &filename );
-    void setIndex( FILE* &inBin, FILE* &inBwt, FILE* &inIdx, FILE* &inMer );
+    void removeFile( string &filename, bool allowMissing=false );
+    void setIndex( FILE* &inBin, FILE* &inBwt, FILE* &inIdx, FILE* &inBlk, FILE* &inMer );
     
     string prefix;
     string bin;
     string bwt;
     string ids;
     string idx;
+    string blk;
     string mer;
+    string dup;
+    
+    // Set when temporary files are to be held in memory, or within scratch files
+    MemoryFiles* mem;
+    ScratchFiles* scratch;
 };
 
 struct PreprocessFiles : public Filenames
 {
     PreprocessFiles( string inPrefix, bool overwrite=false );
     
-    void clean();
+    void clean( bool allowMissing=false );
+    PreprocessFiles* getChunk( int chunk, int chunkCount );
     void setBinaryWrite( FILE* &outBin, FILE* &outBwt, FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5] );
-    void setCycler( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5], uint8_t cycle );
-    void setCyclerIter( FILE* &inIns, FILE* (&inIds)[5], uint8_t cycle, uint8_t i );
-    void setCyclerFinal( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, uint8_t cycle );
-    void setCyclerFinalIter( FILE* &inIns, FILE* &inIds, uint8_t cycle, uint8_t i );
-    void setCyclerUpdate( FILE* &outBwt,  FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5], uint8_t cycle );
+    void setBlocksWrite( FILE* &outBlk );
+    void setCycler( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, FILE* (&outIns)[4], FILE* (&outIds)[4][5], uint16_t cycle, uint8_t i );
+    void setCyclerIter( FILE* &inIns, FILE* (&inIds)[5], uint16_t cycle, uint8_t i, uint8_t seg );
+    void setCyclerFinal( FILE* &inBwt, FILE* &outBwt, FILE* &inEnd, FILE* &outEnd, uint16_t cycle, uint8_t i );
+    void setCyclerFinalIter( FILE* &inIns, FILE* &inIds, uint16_t cycle, uint8_t i, uint8_t seg );
+    void setCyclerMerge( FILE* &inBwt, FILE* &inEnd, uint16_t cycle, uint8_t i );
+    void setCyclerSizes( FILE* (&inBwts)[4], uint16_t cycle );
     void setIndexWrite( FILE* &inBwt, FILE* &outIdx );
+    void setMemory( CharId budget );
     void setMersWrite( FILE* &outMer );
+    void setScratch();
+    void setTmpDirs( vector<string> dirs );
     
     string tmpChr;
     string tmpTrm;
-    string tmpBwt[2];
-    string tmpEnd[2];
-    string tmpIns[2][4];
-    string tmpIds[2][4][5];
     string tmpSingles;
+    
+    // The temporary directories and memory budget, shared out to the chunks of a chunked transform
+    vector<string> tmpDirs;
+    CharId memBudget;
+    
+    // Cycle files are split into one segment per bucket of the cycle that wrote them
+    string tmpBwt[2][4];
+    string tmpEnd[2][4];
+    string tmpIns[2][4][4];
+    string tmpIds[2][4][5][4];
 };
 
 
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mapped_file.h"
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile()
+: data( NULL ), size( 0 )
+{}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+void MappedFile::map( FILE* fp, bool preload )
+{
+    unmap();
+    
+    struct stat st;
+    if ( fstat( fileno( fp ), &st ) || !st.st_size )
+    {
+        cerr << "Error: could not determine size of file to map." << endl;
+        exit( EXIT_FAILURE );
+    }
+    size = st.st_size;
+    
+    // Preloading faults in every page up front; otherwise pages are read lazily on first access
+    void* addr = mmap( NULL, size, PROT_READ, MAP_SHARED | ( preload ? MAP_POPULATE : 0 ), fileno( fp ), 0 );
+    if ( addr == MAP_FAILED )
+    {
+        cerr << "Error: could not memory map file." << endl;
+        exit( EXIT_FAILURE );
+    }
+    data = (uint8_t*)addr;
+    
+    // Rank queries jump about the file, so read-ahead would mostly fetch unwanted pages
+    madvise( data, size, preload ? MADV_WILLNEED : MADV_RANDOM );
+}
+
+void MappedFile::unmap()
+{
+    if ( data ) munmap( data, size );
+    data = NULL;
+    size = 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memory_files.h"
+#include "filenames.h"
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MemoryFiles::MemoryFiles( CharId inBudget )
+: budget( inBudget ), used( 0 )
+{}
+
+MemoryFiles::~MemoryFiles()
+{
+    for ( auto &file : files ) if ( file.second.fd >= 0 ) close( file.second.fd );
+}
+
+void MemoryFiles::add( string &filename, string &twin )
+{
+    // Anything spilt by an earlier session is stale, as spills only hold what this session wrote
+    for ( string* name : { &filename, &twin } )
+    {
+        string spill = *name + "-spill";
+        if ( Filenames::exists( spill ) ) remove( spill.c_str() );
+    }
+    files[filename] = Held{ -1, 0, 0, twin };
+    files[twin] = Held{ -1, 0, 0, filename };
+}
+
+CharId MemoryFiles::estimate( Held &held )
+{
+    // A file rewritten each cycle holds about what its twin of the other generation held last
+    Held &twin = files[held.twin];
+    if ( twin.fd >= 0 ) return max( held.size, twin.size );
+    struct stat st;
+    string spill = held.twin + "-spill";
+    if ( !stat( spill.c_str(), &st ) ) return max( held.size, (CharId)st.st_size );
+    return held.size;
+}
+
+void MemoryFiles::measure()
+{
+    // Files still being written count for at least what was reserved for them when opened
+    used = 0;
+    for ( auto &file : files )
+    {
+        struct stat st;
+        if ( file.second.fd < 0 || fstat( file.second.fd, &st ) ) continue;
+        file.second.size = (CharId)st.st_blocks * 512;
+        used += max( file.second.size, file.second.reserved );
+    }
+}
+
+FILE* MemoryFiles::open( string &filename, char mode )
+{
+    // Modes are 'r' to read, 'e' to edit, 'c' to edit or create and 'w' to write afresh
+    auto it = files.find( filename );
+    if ( it == files.end() ) return NULL;
+    
+    lock_guard<mutex> guard( lock );
+    Held &held = it->second;
+    string spill = filename + "-spill";
+    bool isSpilt = Filenames::exists( spill );
+    
+    if ( mode == 'r' || mode == 'e' || ( mode == 'c' && held.fd < 0 && isSpilt ) )
+    {
+        // A file opened to be read has been written in full
+        if ( mode == 'r' ) held.reserved = 0;
+        if ( held.fd >= 0 ) return reopen( held, mode == 'r' ? "rb" : "rb+" );
+        
+        // Files never written in this session are read from where a previous session left them
+        if ( !isSpilt ) return NULL;
+        FILE* fp = fopen( spill.c_str(), mode == 'r' ? "rb" : "rb+" );
+        if ( fp == NULL )
+        {
+            cerr << "Error opening file \"" << spill << "\"." << endl;
+            exit( EXIT_FAILURE );
+        }
+        return fp;
+    }
+    
+    // Every held file is measured afresh, so that all written since the last open is counted; files edited in place may grow as much as those written afresh
+    measure();
+    CharId reserve = estimate( held );
+    if ( held.fd >= 0 ) used -= max( held.size, held.reserved );
+    if ( used + reserve <= budget )
+    {
+        if ( held.fd < 0 )
+        {
+            held.fd = memfd_create( "leanbwt", 0 );
+            held.size = 0;
+            if ( held.fd < 0 )
+            {
+                cerr << "Error: could not create a temporary file in memory." << endl;
+                exit( EXIT_FAILURE );
+            }
+            if ( isSpilt ) remove( spill.c_str() );
+        }
+        if ( mode == 'w' && ftruncate( held.fd, 0 ) )
+        {
+            cerr << "Error: could not truncate a temporary file in memory." << endl;
+            exit( EXIT_FAILURE );
+        }
+        held.reserved = reserve;
+        used += reserve;
+        return reopen( held, "rb+" );
+    }
+    
+    // Over budget, so this file moves to disk, beside rather than over any copy a previous session may resume from
+    FILE* fp = fopen( spill.c_str(), "wb+" );
+    if ( fp == NULL )
+    {
+        cerr << "Error opening file \"" << spill << "\"." << endl;
+        exit( EXIT_FAILURE );
+    }
+    if ( held.fd >= 0 )
+    {
+        // Files edited in place take what they hold with them
+        if ( mode == 'c' ) spillTo( held, fp );
+        close( held.fd );
+        held.fd = -1;
+    }
+    held.size = held.reserved = 0;
+    return fp;
+}
+
+bool MemoryFiles::release( string &filename )
+{
+    auto it = files.find( filename );
+    if ( it == files.end() ) return false;
+    
+    lock_guard<mutex> guard( lock );
+    Held &held = it->second;
+    string spill = filename + "-spill";
+    bool didHold = held.fd >= 0 || Filenames::exists( spill );
+    if ( held.fd >= 0 )
+    {
+        close( held.fd );
+        used -= min( used, max( held.size, held.reserved ) );
+        held.fd = -1;
+    }
+    held.size = held.reserved = 0;
+    if ( Filenames::exists( spill ) ) remove( spill.c_str() );
+    return didHold;
+}
+
+FILE* MemoryFiles::reopen( Held &held, const char* mode )
+{
+    // Reopening through /proc gives each stream its own file offset, unlike dup()
+    int fd = ::open( ( "/proc/self/fd/" + to_string( held.fd ) ).c_str(), O_RDWR );
+    FILE* fp = fd < 0 ? NULL : fdopen( fd, mode );
+    if ( fp == NULL )
+    {
+        cerr << "Error: could not open a temporary file held in memory." << endl;
+        exit( EXIT_FAILURE );
+    }
+    return fp;
+}
+
+void MemoryFiles::spillTo( Held &held, FILE* fp )
+{
+    vector<char> buff( 1 << 20 );
+    ssize_t n;
+    for ( off_t pos = 0; ( n = pread( held.fd, buff.data(), buff.size(), pos ) ) > 0; pos += n )
+    {
+        if ( fwrite( buff.data(), 1, n, fp ) != (size_t)n )
+        {
+            cerr << "Error: could not move a temporary file from memory to disk." << endl;
+            exit( EXIT_FAILURE );
+        }
+    }
+    if ( n < 0 )
+    {
+        cerr << "Error: could not move a temporary file from memory to disk." << endl;
+        exit( EXIT_FAILURE );
+    }
+    rewind( fp );
+}
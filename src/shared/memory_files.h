@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMORY_FILES_H
+#define MEMORY_FILES_H
+
+#include "types.h"
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+
+// Holds temporary files in anonymous memory, spilling them to disk once the byte budget is spent
+struct MemoryFiles
+{
+    MemoryFiles( CharId inBudget );
+    ~MemoryFiles();
+    
+    void add( string &filename, string &twin );
+    FILE* open( string &filename, char mode );
+    bool release( string &filename );
+    
+private:
+    struct Held
+    {
+        int fd;
+        CharId size, reserved;
+        string twin;
+    };
+    
+    CharId estimate( Held &held );
+    void measure();
+    FILE* reopen( Held &held, const char* mode );
+    void spillTo( Held &held, FILE* fp );
+    
+    unordered_map<string, Held> files;
+    mutex lock;
+    CharId budget, used;
+};
+
+#endif /* MEMORY_FILES_H */
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scheduler.h"
+#include <mutex>
+#include <thread>
+
+struct WorkRange
+{
+    mutex lock;
+    size_t begin, end;
+};
+
+static bool takeJob( WorkRange& range, size_t& i )
+{
+    lock_guard<mutex> guard( range.lock );
+    if ( range.begin == range.end ) return false;
+    i = range.begin++;
+    return true;
+}
+
+static bool stealJobs( WorkRange& victim, WorkRange& thief )
+{
+    size_t begin, end;
+    {
+        lock_guard<mutex> guard( victim.lock );
+        size_t left = victim.end - victim.begin;
+        if ( !left ) return false;
+        end = victim.end;
+        begin = victim.end -= ( left + 1 ) / 2;
+    }
+    lock_guard<mutex> guard( thief.lock );
+    thief.begin = begin;
+    thief.end = end;
+    return true;
+}
+
+void WorkScheduler::run( size_t jobCount, int threadCount, const function<void( size_t )>& job )
+{
+    threadCount = max( 1, min( threadCount, (int)jobCount ) );
+    
+    // Each worker starts with an even contiguous share and takes jobs from the front of it
+    vector<WorkRange> ranges( threadCount );
+    for ( int t = 0; t < threadCount; t++ )
+    {
+        ranges[t].begin = jobCount * t / threadCount;
+        ranges[t].end = jobCount * ( t + 1 ) / threadCount;
+    }
+    
+    // Once its own share runs dry, a worker steals the back half of another's remaining share
+    auto worker = [&]( int t )
+    {
+        for ( ;; )
+        {
+            size_t i;
+            while ( takeJob( ranges[t], i ) ) job( i );
+            bool stolen = false;
+            for ( int k = 1; !stolen && k < threadCount; k++ ) stolen = stealJobs( ranges[ ( t + k ) % threadCount ], ranges[t] );
+            if ( !stolen ) return;
+        }
+    };
+    
+    vector<thread> threads;
+    for ( int t = 1; t < threadCount; t++ ) threads.push_back( thread( worker, t ) );
+    worker( 0 );
+    for ( thread& th : threads ) th.join();
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scratch_files.h"
+#include "filenames.h"
+#include <iostream>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+ScratchFiles::ScratchFiles()
+{}
+
+ScratchFiles::~ScratchFiles()
+{
+    for ( auto &scratch : scratches )
+    {
+        if ( scratch.second->fd >= 0 ) ::close( scratch.second->fd );
+        delete scratch.second;
+    }
+}
+
+void ScratchFiles::add( string &filename, string &scratchname )
+{
+    auto it = scratches.find( scratchname );
+    if ( it == scratches.end() )
+    {
+        // The scratch file itself is only opened once one of its files is, so that runs stopping early leave nothing behind
+        Scratch* scratch = new Scratch();
+        scratch->name = scratchname;
+        scratch->fd = -1;
+        scratch->extents = 0;
+        scratch->loaded = false;
+        it = scratches.insert( make_pair( scratchname, scratch ) ).first;
+        load( scratch );
+    }
+    
+    // Files loaded from the scratch file's map already belong to it
+    if ( files.find( filename ) == files.end() ) files[filename] = Held{ it->second, vector<uint32_t>(), 0, false };
+}
+
+uint32_t ScratchFiles::allocate( Scratch* scratch )
+{
+    lock_guard<mutex> guard( scratch->lock );
+    if ( scratch->spare.empty() ) return scratch->extents++;
+    uint32_t extent = scratch->spare.back();
+    scratch->spare.pop_back();
+    return extent;
+}
+
+void ScratchFiles::attach( Scratch* scratch )
+{
+    // A scratch file is created afresh unless its map was loaded, in which case it must already exist
+    lock_guard<mutex> guard( scratch->lock );
+    if ( scratch->fd >= 0 ) return;
+    scratch->fd = ::open( scratch->name.c_str(), scratch->loaded ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+    if ( scratch->fd < 0 )
+    {
+        cerr << "Error opening file \"" << scratch->name << "\"." << endl;
+        exit( EXIT_FAILURE );
+    }
+}
+
+void ScratchFiles::clean()
+{
+    for ( auto &scratch : scratches )
+    {
+        string map = scratch.second->name + "-map";
+        if ( scratch.second->fd >= 0 ) ::close( scratch.second->fd );
+        scratch.second->fd = -1;
+        if ( Filenames::exists( scratch.second->name ) ) remove( scratch.second->name.c_str() );
+        if ( Filenames::exists( map ) ) remove( map.c_str() );
+    }
+    files.clear();
+}
+
+int ScratchFiles::close( void* cookie )
+{
+    delete (Stream*)cookie;
+    return 0;
+}
+
+void ScratchFiles::discard( Held &held )
+{
+    // Lowest extents are handed out first, keeping the scratch file compact
+    lock_guard<mutex> guard( held.scratch->lock );
+    for ( auto it = held.extents.rbegin(); it != held.extents.rend(); it++ ) held.scratch->spare.push_back( *it );
+    held.extents.clear();
+    held.size = 0;
+}
+
+void ScratchFiles::load( Scratch* scratch )
+{
+    // Without a map, nothing in the scratch file can be resumed from
+    string map = scratch->name + "-map";
+    FILE* fp = fopen( map.c_str(), "rb" );
+    if ( fp == NULL ) return;
+    scratch->loaded = true;
+    
+    uint32_t fileCount = 0;
+    bool good = fread( &scratch->extents, 4, 1, fp ) && fread( &fileCount, 4, 1, fp );
+    vector<bool> owned( scratch->extents, false );
+    for ( uint32_t i = 0; good && i < fileCount; i++ )
+    {
+        uint16_t len = 0;
+        uint32_t extentCount = 0;
+        Held held{ scratch, vector<uint32_t>(), 0, true };
+        good = fread( &len, 2, 1, fp );
+        string filename( len, '\0' );
+        good = good && fread( &filename[0], 1, len, fp ) == len && fread( &held.size, 8, 1, fp ) && fread( &extentCount, 4, 1, fp );
+        held.extents.resize( good ? extentCount : 0 );
+        good = good && fread( held.extents.data(), 4, extentCount, fp ) == extentCount;
+        for ( uint32_t extent : held.extents )
+        {
+            good = good && extent < scratch->extents && !owned[extent];
+            if ( good ) owned[extent] = true;
+        }
+        if ( good ) files[filename] = held;
+    }
+    fclose( fp );
+    
+    if ( !good )
+    {
+        cerr << "Error: the map of scratch file \"" << scratch->name << "\" is corrupt." << endl;
+        exit( EXIT_FAILURE );
+    }
+    for ( uint32_t i = scratch->extents; i-- > 0; ) if ( !owned[i] ) scratch->spare.push_back( i );
+}
+
+FILE* ScratchFiles::open( string &filename, char mode )
+{
+    // Modes are 'r' to read, 'e' to edit, 'c' to edit or create and 'w' to write afresh; unwritten files are left for the caller to find on disk
+    auto it = files.find( filename );
+    if ( it == files.end() ) return NULL;
+    Held &held = it->second;
+    if ( ( mode == 'r' || mode == 'e' ) && !held.exists ) return NULL;
+    
+    attach( held.scratch );
+    if ( mode == 'w' ) discard( held );
+    held.exists = true;
+    
+    cookie_io_functions_t io = { read, write, seek, close };
+    FILE* fp = fopencookie( new Stream{ &held, 0 }, mode == 'r' ? "rb" : "rb+", io );
+    if ( fp == NULL )
+    {
+        cerr << "Error opening file \"" << filename << "\" within its scratch file." << endl;
+        exit( EXIT_FAILURE );
+    }
+    return fp;
+}
+
+ssize_t ScratchFiles::read( void* cookie, char* buf, size_t len )
+{
+    Stream* stream = (Stream*)cookie;
+    Held &held = *stream->held;
+    if ( stream->pos >= held.size ) return 0;
+    len = min( (CharId)len, held.size - stream->pos );
+    
+    for ( size_t done = 0; done < len; )
+    {
+        CharId off = stream->pos & ( ( (CharId)1 << SCRATCH_EXTENT_BITS ) - 1 );
+        CharId base = ( (CharId)held.extents[stream->pos >> SCRATCH_EXTENT_BITS] << SCRATCH_EXTENT_BITS ) + off;
+        size_t n = min( (CharId)( len - done ), ( (CharId)1 << SCRATCH_EXTENT_BITS ) - off );
+        
+        // Anything skipped over when written may lie beyond the end of the scratch file
+        for ( size_t got = 0; got < n; )
+        {
+            ssize_t r = pread( held.scratch->fd, buf + done + got, n - got, base + got );
+            if ( r < 0 )
+            {
+                cerr << "Error: could not read from scratch file \"" << held.scratch->name << "\"." << endl;
+                exit( EXIT_FAILURE );
+            }
+            if ( !r ) memset( buf + done + got, 0, n - got );
+            got += r ? r : n - got;
+        }
+        done += n;
+        stream->pos += n;
+    }
+    return len;
+}
+
+bool ScratchFiles::release( string &filename )
+{
+    auto it = files.find( filename );
+    if ( it == files.end() ) return false;
+    bool didHold = it->second.exists;
+    discard( it->second );
+    it->second.exists = false;
+    return didHold;
+}
+
+void ScratchFiles::save()
+{
+    // Maps are replaced whole, so that an interrupted save leaves the previous one in place
+    for ( auto &scratch : scratches )
+    {
+        if ( scratch.second->fd < 0 ) continue;
+        string map = scratch.second->name + "-map", tmp = map + "-tmp";
+        vector<uint8_t> out;
+        auto put = [&]( const void* data, size_t len ){ out.insert( out.end(), (uint8_t*)data, (uint8_t*)data + len ); };
+        uint32_t fileCount = 0;
+        put( &scratch.second->extents, 4 );
+        put( &fileCount, 4 );
+        for ( auto &file : files )
+        {
+            if ( file.second.scratch != scratch.second || !file.second.exists ) continue;
+            uint16_t len = file.first.size();
+            uint32_t extentCount = file.second.extents.size();
+            put( &len, 2 );
+            put( file.first.data(), len );
+            put( &file.second.size, 8 );
+            put( &extentCount, 4 );
+            put( file.second.extents.data(), extentCount * 4 );
+            fileCount++;
+        }
+        memcpy( &out[4], &fileCount, 4 );
+        
+        FILE* fp = fopen( tmp.c_str(), "wb" );
+        if ( fp == NULL || fwrite( out.data(), 1, out.size(), fp ) != out.size() || fclose( fp ) || rename( tmp.c_str(), map.c_str() ) )
+        {
+            cerr << "Error writing file \"" << map << "\"." << endl;
+            exit( EXIT_FAILURE );
+        }
+    }
+}
+
+int ScratchFiles::seek( void* cookie, off64_t* offset, int whence )
+{
+    Stream* stream = (Stream*)cookie;
+    off64_t base = whence == SEEK_SET ? 0 : ( whence == SEEK_CUR ? stream->pos : stream->held->size );
+    if ( base + *offset < 0 ) return -1;
+    stream->pos = *offset = base + *offset;
+    return 0;
+}
+
+ssize_t ScratchFiles::write( void* cookie, const char* buf, size_t len )
+{
+    Stream* stream = (Stream*)cookie;
+    Held &held = *stream->held;
+    
+    for ( size_t done = 0; done < len; )
+    {
+        while ( held.extents.size() <= ( stream->pos >> SCRATCH_EXTENT_BITS ) ) held.extents.push_back( allocate( held.scratch ) );
+        CharId off = stream->pos & ( ( (CharId)1 << SCRATCH_EXTENT_BITS ) - 1 );
+        CharId base = ( (CharId)held.extents[stream->pos >> SCRATCH_EXTENT_BITS] << SCRATCH_EXTENT_BITS ) + off;
+        size_t n = min( (CharId)( len - done ), ( (CharId)1 << SCRATCH_EXTENT_BITS ) - off );
+        
+        for ( size_t put = 0; put < n; )
+        {
+            ssize_t r = pwrite( held.scratch->fd, buf + done + put, n - put, base + put );
+            if ( r <= 0 )
+            {
+                cerr << "Error: could not write to scratch file \"" << held.scratch->name << "\"." << endl;
+                exit( EXIT_FAILURE );
+            }
+            put += r;
+        }
+        done += n;
+        stream->pos += n;
+        held.size = max( held.size, stream->pos );
+    }
+    return len;
+}
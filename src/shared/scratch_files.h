@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCRATCH_FILES_H
+#define SCRATCH_FILES_H
+
+#include "types.h"
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+
+// Scratch files are split into extents of 1 MB, each owned by at most one of the files held within
+#define SCRATCH_EXTENT_BITS 20
+
+// Holds temporary files as extents of a few scratch files, so that opening, rewriting or removing them costs no file system metadata
+struct ScratchFiles
+{
+    ScratchFiles();
+    ~ScratchFiles();
+    
+    void add( string &filename, string &scratchname );
+    void clean();
+    FILE* open( string &filename, char mode );
+    bool release( string &filename );
+    void save();
+    
+private:
+    struct Scratch
+    {
+        string name;
+        int fd;
+        uint32_t extents;
+        vector<uint32_t> spare;
+        bool loaded;
+        mutex lock;
+    };
+    
+    struct Held
+    {
+        Scratch* scratch;
+        vector<uint32_t> extents;
+        CharId size;
+        bool exists;
+    };
+    
+    struct Stream
+    {
+        Held* held;
+        CharId pos;
+    };
+    
+    static uint32_t allocate( Scratch* scratch );
+    static void attach( Scratch* scratch );
+    static void discard( Held &held );
+    void load( Scratch* scratch );
+    
+    static ssize_t read( void* cookie, char* buf, size_t len );
+    static ssize_t write( void* cookie, const char* buf, size_t len );
+    static int seek( void* cookie, off64_t* offset, int whence );
+    static int close( void* cookie );
+    
+    unordered_map<string, Held> files;
+    unordered_map<string, Scratch*> scratches;
+};
+
+#endif /* SCRATCH_FILES_H */
+
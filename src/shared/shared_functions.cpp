@@ -21,6 +21,8 @@
 #include "shared_functions.h"
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <iostream>
 #include <string.h>
 
 char getComp( char c )
@@ -257,6 +259,44 @@ int mapSeqOverlap( string &q, string &t, int minLen, bool drxn )
     return mapSeqOverlap( drxn ? q : t, drxn ? t : q, minLen );
 }
 
+// Read counts in the binary header take 4 bytes; a larger count saturates its slot and is held in full in the wide block after the libraries
+ReadId readBinaryCount( FILE* bin, CharId wideSeek )
+{
+    uint32_t count;
+    fread( &count, 4, 1, bin );
+    if ( count < UINT32_MAX ) return count;
+    if ( sizeof( ReadId ) < 8 )
+    {
+        cerr << "Error: these reads were indexed with 64-bit read ids. Rebuild with \"make WIDE_IDS=1\" to read them." << endl;
+        exit( EXIT_FAILURE );
+    }
+    uint64_t wideCount;
+    long pos = ftell( bin );
+    fseek( bin, wideSeek, SEEK_SET );
+    fread( &wideCount, 8, 1, bin );
+    fseek( bin, pos, SEEK_SET );
+    return wideCount;
+}
+
+void readBinaryLength( FILE* bin, uint8_t seqsBegin, uint16_t &readLen, uint16_t &cycle )
+{
+    // Reads longer than 255 leave their one byte fields zero, and keep both as 16 bits at the end of the header
+    uint8_t len8, cycle8;
+    long pos = ftell( bin );
+    fseek( bin, 9, SEEK_SET );
+    fread( &len8, 1, 1, bin );
+    fread( &cycle8, 1, 1, bin );
+    readLen = len8;
+    cycle = cycle8;
+    if ( !len8 )
+    {
+        fseek( bin, seqsBegin - 4, SEEK_SET );
+        fread( &readLen, 2, 1, bin );
+        fread( &cycle, 2, 1, bin );
+    }
+    fseek( bin, pos, SEEK_SET );
+}
+
 void revComp( string &seq )
 {
     reverse( seq.begin(), seq.end() );
@@ -292,3 +332,21 @@ string revCompNew( string &seq )
     }
     return rev;
 }
+
+void writeBinaryCount( FILE* bin, ReadId count, CharId wideSeek )
+{
+    uint32_t slot = min( (uint64_t)count, (uint64_t)UINT32_MAX );
+    fwrite( &slot, 4, 1, bin );
+    if ( slot < UINT32_MAX ) return;
+    uint64_t wideCount = count;
+    long pos = ftell( bin );
+    fseek( bin, wideSeek, SEEK_SET );
+    fwrite( &wideCount, 8, 1, bin );
+    fseek( bin, pos, SEEK_SET );
+}
+
+void writeBinaryCycle( FILE* bin, uint8_t seqsBegin, uint16_t readLen, uint16_t cycle )
+{
+    fseek( bin, readLen > 255 ? seqsBegin - 2 : 10, SEEK_SET );
+    fwrite( &cycle, readLen > 255 ? 2 : 1, 1, bin );
+}
@@ -23,6 +23,7 @@
 
 #include "types.h"
 #include <fstream>
+#include <cstdio>
 
 char getComp( char c );
 int getEndTrim( string &q, string trim, bool drxn );
@@ -36,8 +37,12 @@ bool mapSeqCongruent( string &left, string &right, int offset );
 bool mapSeqEnd( string &q, string &t, int minLen, int32_t* coords, bool drxn );
 int mapSeqOverlap( string &left, string &right, int minLen );
 int mapSeqOverlap( string &q, string &t, int minLen, bool drxn );
+ReadId readBinaryCount( FILE* bin, CharId wideSeek );
+void readBinaryLength( FILE* bin, uint8_t seqsBegin, uint16_t &readLen, uint16_t &cycle );
 void revComp( string &seq );
 string revCompNew( string &seq );
+void writeBinaryCount( FILE* bin, ReadId count, CharId wideSeek );
+void writeBinaryCycle( FILE* bin, uint8_t seqsBegin, uint16_t readLen, uint16_t cycle );
 
 #endif /* SHARED_FUNCTIONS_H */
 
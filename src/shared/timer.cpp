@@ -21,9 +21,8 @@
 #include "timer.h"
 #include <ctime>
 
-string getDuration( double startTime )
+static string formatDuration( double totalDuration )
 {
-    double totalDuration = ( clock() - startTime ) / CLOCKS_PER_SEC;
     int hrs = totalDuration / 3600;
     int mins = int( totalDuration / 60 ) % 60;
     int secs = int(max( 1.0, totalDuration ) ) % 60;
@@ -31,3 +30,13 @@ string getDuration( double startTime )
             + ( mins > 0 ? to_string( mins ) + " min " : "" )
             + to_string( secs ) + " sec" );
 }
+
+string getDuration( double startTime )
+{
+    return formatDuration( ( clock() - startTime ) / CLOCKS_PER_SEC );
+}
+
+string getDuration( chrono::steady_clock::time_point startTime )
+{
+    return formatDuration( chrono::duration<double>( chrono::steady_clock::now() - startTime ).count() );
+}
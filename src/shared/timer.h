@@ -22,10 +22,14 @@
 #define TIMER_H
 
 #include <string>
+#include <chrono>
 
 using namespace std;
 
+// CPU time since a clock() reading
 string getDuration( double startTime );
+// Wall time, for work shared out among threads
+string getDuration( chrono::steady_clock::time_point startTime );
 
 #endif /* TIME_H */
 
@@ -32,8 +32,14 @@ using namespace std;
 
 #define LEANBWT_VERSION "1.0"
 
+// Read ids are 32-bit unless built with WIDE_IDS, which lifts the limit of about 4 billion reads including reverse complements
+#ifdef WIDE_IDS
+typedef uint64_t ReadId;
+typedef uint64_t SeqNum;
+#else
 typedef uint32_t ReadId;
 typedef uint32_t SeqNum;
+#endif
 typedef uint64_t CharId;
 
 
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "io_ring.h"
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+IoRing::IoRing()
+: ringFd( -1 ), entries( 0 ), inFlight( 0 ), sqes( (io_uring_sqe*)MAP_FAILED ), sqRing( MAP_FAILED ), cqRing( MAP_FAILED )
+{
+}
+
+IoRing::~IoRing()
+{
+    if ( sqes != MAP_FAILED ) munmap( sqes, entries * sizeof( io_uring_sqe ) );
+    if ( cqRing != MAP_FAILED && cqRing != sqRing ) munmap( cqRing, cqSize );
+    if ( sqRing != MAP_FAILED ) munmap( sqRing, sqSize );
+    if ( ringFd >= 0 ) close( ringFd );
+}
+
+void IoRing::enter( unsigned submit, unsigned complete )
+{
+    while ( syscall( __NR_io_uring_enter, ringFd, submit, complete, complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0 ) < 0 )
+    {
+        if ( errno == EINTR || errno == EAGAIN || errno == EBUSY ) continue;
+        cerr << "Error: asynchronous I/O failed: " << strerror( errno ) << "." << endl;
+        exit( EXIT_FAILURE );
+    }
+}
+
+bool IoRing::init( unsigned inEntries )
+{
+    // Kernels or sandboxes without io_uring refuse the setup, leaving the caller to fall back to blocking I/O
+    io_uring_params params;
+    memset( &params, 0, sizeof( params ) );
+    ringFd = syscall( __NR_io_uring_setup, inEntries, &params );
+    if ( ringFd < 0 ) return false;
+    entries = params.sq_entries;
+    
+    sqSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+    cqSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+    if ( params.features & IORING_FEAT_SINGLE_MMAP ) sqSize = cqSize = max( sqSize, cqSize );
+    sqRing = mmap( NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING );
+    if ( sqRing == MAP_FAILED ) return false;
+    cqRing = params.features & IORING_FEAT_SINGLE_MMAP ? sqRing
+           : mmap( NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING );
+    if ( cqRing == MAP_FAILED ) return false;
+    sqes = (io_uring_sqe*)mmap( NULL, entries * sizeof( io_uring_sqe ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES );
+    if ( sqes == MAP_FAILED ) return false;
+    
+    uint8_t* sq = (uint8_t*)sqRing,* cq = (uint8_t*)cqRing;
+    sqHead = (unsigned*)( sq + params.sq_off.head );
+    sqTail = (unsigned*)( sq + params.sq_off.tail );
+    sqMask = (unsigned*)( sq + params.sq_off.ring_mask );
+    sqArray = (unsigned*)( sq + params.sq_off.array );
+    cqHead = (unsigned*)( cq + params.cq_off.head );
+    cqTail = (unsigned*)( cq + params.cq_off.tail );
+    cqMask = (unsigned*)( cq + params.cq_off.ring_mask );
+    cqes = (io_uring_cqe*)( cq + params.cq_off.cqes );
+    return true;
+}
+
+void IoRing::queue( uint8_t op, IoSlot* slot )
+{
+    // No more requests are made than the ring holds, so that completions never overflow
+    while ( inFlight == entries )
+    {
+        enter( queued(), 1 );
+        reap();
+    }
+    
+    unsigned tail = *sqTail, i = tail & *sqMask;
+    io_uring_sqe* sqe = &sqes[i];
+    memset( sqe, 0, sizeof( io_uring_sqe ) );
+    sqe->opcode = op;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)( slot->buf );
+    sqe->len = slot->len;
+    sqe->off = slot->offset;
+    sqe->user_data = (uint64_t)slot;
+    sqArray[i] = i;
+    __atomic_store_n( sqTail, tail + 1, __ATOMIC_RELEASE );
+    
+    // Requests are submitted together with the next wait, saving a system call for each
+    slot->busy = slot->pending = true;
+    inFlight++;
+}
+
+unsigned IoRing::queued()
+{
+    // The kernel advances the head past each request it has taken up
+    return *sqTail - __atomic_load_n( sqHead, __ATOMIC_ACQUIRE );
+}
+
+void IoRing::read( int fd, uint8_t* buf, uint32_t len, CharId offset, IoSlot* slot )
+{
+    slot->fd = fd;
+    slot->buf = buf;
+    slot->len = len;
+    slot->offset = offset;
+    slot->isWrite = false;
+    queue( IORING_OP_READ, slot );
+}
+
+void IoRing::reap()
+{
+    unsigned head = *cqHead, tail = __atomic_load_n( cqTail, __ATOMIC_ACQUIRE );
+    for ( ; head != tail; head++ )
+    {
+        io_uring_cqe* cqe = &cqes[ head & *cqMask ];
+        IoSlot* slot = (IoSlot*)cqe->user_data;
+        slot->res = cqe->res;
+        slot->busy = false;
+        inFlight--;
+    }
+    __atomic_store_n( cqHead, head, __ATOMIC_RELEASE );
+}
+
+void IoRing::wait( IoSlot* slot )
+{
+    if ( !slot->pending ) return;
+    slot->pending = false;
+    reap();
+    while ( slot->busy || queued() )
+    {
+        enter( queued(), slot->busy );
+        reap();
+    }
+    
+    if ( slot->res < 0 )
+    {
+        cerr << "Error: asynchronous " << ( slot->isWrite ? "write" : "read" ) << " failed: " << strerror( -slot->res ) << "." << endl;
+        exit( EXIT_FAILURE );
+    }
+    
+    // Anything left short is finished with blocking calls; a read stops short only at the end of its file
+    for ( uint32_t done = slot->res; done < slot->len; )
+    {
+        ssize_t n = slot->isWrite ? pwrite( slot->fd, slot->buf + done, slot->len - done, slot->offset + done )
+                                  : pread( slot->fd, slot->buf + done, slot->len - done, slot->offset + done );
+        if ( n < 0 && errno == EINTR ) continue;
+        if ( n < 0 || ( !n && slot->isWrite ) )
+        {
+            cerr << "Error: asynchronous " << ( slot->isWrite ? "write" : "read" ) << " failed: " << strerror( errno ) << "." << endl;
+            exit( EXIT_FAILURE );
+        }
+        if ( !n ) break;
+        done += n;
+        slot->res = done;
+    }
+}
+
+void IoRing::write( int fd, uint8_t* buf, uint32_t len, CharId offset, IoSlot* slot )
+{
+    slot->fd = fd;
+    slot->buf = buf;
+    slot->len = len;
+    slot->offset = offset;
+    slot->isWrite = true;
+    queue( IORING_OP_WRITE, slot );
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include "types.h"
+#include <linux/io_uring.h>
+
+// A request's slot stays pending until it is waited on, and its buffer must not be touched until then
+struct IoSlot
+{
+    IoSlot(): busy( false ), pending( false ){}
+    uint8_t* buf;
+    CharId offset;
+    uint32_t len;
+    int fd, res;
+    bool busy, pending, isWrite;
+};
+
+// Asynchronous reads and writes through a Linux io_uring, driven by raw system calls so that no library is needed
+// A ring belongs to one thread; it must outlive every request made through it
+struct IoRing
+{
+    IoRing();
+    ~IoRing();
+    
+    bool init( unsigned entries );
+    void read( int fd, uint8_t* buf, uint32_t len, CharId offset, IoSlot* slot );
+    void write( int fd, uint8_t* buf, uint32_t len, CharId offset, IoSlot* slot );
+    void wait( IoSlot* slot );
+    
+private:
+    void enter( unsigned submit, unsigned complete );
+    void queue( uint8_t op, IoSlot* slot );
+    unsigned queued();
+    void reap();
+    
+    int ringFd;
+    unsigned entries, inFlight;
+    unsigned* sqHead,* sqTail,* sqMask,* sqArray;
+    unsigned* cqHead,* cqTail,* cqMask;
+    io_uring_sqe* sqes;
+    io_uring_cqe* cqes;
+    void* sqRing,* cqRing;
+    size_t sqSize, cqSize;
+};
+
+#endif /* IO_RING_H */
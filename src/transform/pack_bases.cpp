@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pack_bases.h"
+#include "constants.h"
+#include "transform_constants.h"
+#include <string.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define PACK_BASES_X86
+#endif
+
+static bool packScalar( const char* read, size_t len, uint8_t* packed, uint8_t* codes, size_t j )
+{
+    for ( ; j < len; j++ )
+    {
+        uint8_t c = charToInt[ (uint8_t)read[j] ];
+        if ( c > 3 ) return false;
+        codes[j] = c;
+        if ( !( j & 0x3 ) ) packed[j/4] = intToByte[0][c];
+        else packed[j/4] += intToByte[j & 0x3][c];
+    }
+    return true;
+}
+
+#ifdef PACK_BASES_X86
+
+// Both cases of ACGT become 0-3 as ( ( c >> 1 ) ^ ( c >> 2 ) ) & 3; the 16-bit shifts only spill into bits that are masked off
+__attribute__(( target( "ssse3" ) ))
+static bool packSsse3( const char* read, size_t len, uint8_t* packed, uint8_t* codes )
+{
+    const __m128i lower = _mm_set1_epi8( 0x20 ), mask = _mm_set1_epi8( 3 );
+    const __m128i a = _mm_set1_epi8( 'a' ), c = _mm_set1_epi8( 'c' ), g = _mm_set1_epi8( 'g' ), t = _mm_set1_epi8( 't' );
+    const __m128i pairs = _mm_set1_epi16( 0x0104 ), quads = _mm_set1_epi32( 0x00010010 );
+    const __m128i gather = _mm_setr_epi8( 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 );
+    size_t j = 0;
+    for ( ; j + 16 <= len; j += 16 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i*)( read + j ) );
+        __m128i l = _mm_or_si128( v, lower );
+        __m128i ok = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( l, a ), _mm_cmpeq_epi8( l, c ) ), _mm_or_si128( _mm_cmpeq_epi8( l, g ), _mm_cmpeq_epi8( l, t ) ) );
+        if ( _mm_movemask_epi8( ok ) != 0xFFFF ) return false;
+        __m128i x = _mm_and_si128( _mm_xor_si128( _mm_srli_epi16( v, 1 ), _mm_srli_epi16( v, 2 ) ), mask );
+        _mm_storeu_si128( (__m128i*)( codes + j ), x );
+        
+        // Pairs of codes become nibbles, pairs of nibbles become bytes, then the four bytes are gathered
+        x = _mm_madd_epi16( _mm_maddubs_epi16( x, pairs ), quads );
+        uint32_t out = _mm_cvtsi128_si32( _mm_shuffle_epi8( x, gather ) );
+        memcpy( packed + j/4, &out, 4 );
+    }
+    return packScalar( read, len, packed, codes, j );
+}
+
+__attribute__(( target( "avx2" ) ))
+static bool packAvx2( const char* read, size_t len, uint8_t* packed, uint8_t* codes )
+{
+    const __m256i lower = _mm256_set1_epi8( 0x20 ), mask = _mm256_set1_epi8( 3 );
+    const __m256i a = _mm256_set1_epi8( 'a' ), c = _mm256_set1_epi8( 'c' ), g = _mm256_set1_epi8( 'g' ), t = _mm256_set1_epi8( 't' );
+    const __m256i pairs = _mm256_set1_epi16( 0x0104 ), quads = _mm256_set1_epi32( 0x00010010 );
+    const __m256i gather = _mm256_setr_epi8( 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 );
+    const __m256i lanes = _mm256_setr_epi32( 0, 4, 1, 1, 1, 1, 1, 1 );
+    size_t j = 0;
+    for ( ; j + 32 <= len; j += 32 )
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)( read + j ) );
+        __m256i l = _mm256_or_si256( v, lower );
+        __m256i ok = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( l, a ), _mm256_cmpeq_epi8( l, c ) ), _mm256_or_si256( _mm256_cmpeq_epi8( l, g ), _mm256_cmpeq_epi8( l, t ) ) );
+        if ( (uint32_t)_mm256_movemask_epi8( ok ) != 0xFFFFFFFF ) return false;
+        __m256i x = _mm256_and_si256( _mm256_xor_si256( _mm256_srli_epi16( v, 1 ), _mm256_srli_epi16( v, 2 ) ), mask );
+        _mm256_storeu_si256( (__m256i*)( codes + j ), x );
+        
+        // As above, with the four bytes of each 128-bit lane brought together by a cross-lane permute
+        x = _mm256_madd_epi16( _mm256_maddubs_epi16( x, pairs ), quads );
+        x = _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8( x, gather ), lanes );
+        _mm_storel_epi64( (__m128i*)( packed + j/4 ), _mm256_castsi256_si128( x ) );
+    }
+    return packScalar( read, len, packed, codes, j );
+}
+
+#endif
+
+static bool packPortable( const char* read, size_t len, uint8_t* packed, uint8_t* codes )
+{
+    return packScalar( read, len, packed, codes, 0 );
+}
+
+bool packBases( const char* read, size_t len, uint8_t* packed, uint8_t* codes )
+{
+    // The kernel is chosen once from what the running CPU supports
+    typedef bool (*PackFn)( const char*, size_t, uint8_t*, uint8_t* );
+#ifdef PACK_BASES_X86
+    static const PackFn kernel = __builtin_cpu_supports( "avx2" ) ? packAvx2 : __builtin_cpu_supports( "ssse3" ) ? packSsse3 : packPortable;
+#else
+    static const PackFn kernel = packPortable;
+#endif
+    return kernel( read, len, packed, codes );
+}
+
+#ifdef __SSE2__
+
+// Four rounds of interleaving each row with the one eight below it transpose a 16 by 16 block of bytes
+static void transpose16( const uint8_t* rows, size_t stride, uint8_t* const* cols, size_t offset )
+{
+    __m128i a[16], b[16];
+    for ( int i = 0; i < 16; i++ ) a[i] = _mm_loadu_si128( (const __m128i*)( rows + i * stride ) );
+    for ( int round = 0; round < 4; round++ )
+    {
+        for ( int i = 0; i < 8; i++ )
+        {
+            b[2*i] = _mm_unpacklo_epi8( a[i], a[i+8] );
+            b[2*i+1] = _mm_unpackhi_epi8( a[i], a[i+8] );
+        }
+        memcpy( a, b, sizeof( a ) );
+    }
+    for ( int i = 0; i < 16; i++ ) _mm_storeu_si128( (__m128i*)( cols[i] + offset ), a[i] );
+}
+
+#endif
+
+void transposeBytes( const uint8_t* rows, size_t rowCount, size_t stride, size_t first, size_t last, uint8_t* const* cols, size_t offset )
+{
+    size_t r = 0;
+#ifdef __SSE2__
+    for ( ; r + 16 <= rowCount; r += 16 )
+    {
+        size_t k = first;
+        for ( ; k + 16 <= last; k += 16 ) transpose16( rows + r * stride + k, stride, cols + k, offset + r );
+        for ( ; k < last; k++ ) for ( size_t i = 0; i < 16; i++ ) cols[k][ offset + r + i ] = rows[ ( r + i ) * stride + k ];
+    }
+#endif
+    for ( ; r < rowCount; r++ ) for ( size_t k = first; k < last; k++ ) cols[k][ offset + r ] = rows[ r * stride + k ];
+}
+
+void unpackBases( const uint8_t* packed, size_t len, uint8_t* codes )
+{
+    static const struct Table
+    {
+        Table()
+        {
+            for ( int b = 0; b < 256; b++ ) codes[b] = ( b >> 6 ) | ( ( b >> 4 ) & 3 ) << 8 | ( ( b >> 2 ) & 3 ) << 16 | ( b & 3 ) << 24;
+        }
+        uint32_t codes[256];
+    } table;
+    for ( size_t j = 0; j < len; j += 4 ) memcpy( codes + j, &table.codes[ packed[ j / 4 ] ], 4 );
+}
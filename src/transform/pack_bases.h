@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACK_BASES_H
+#define PACK_BASES_H
+
+#include "types.h"
+
+// Translates a read into 2-bit codes and packs them four to a byte, first base in the high bits; false if any base is not ACGT
+bool packBases( const char* read, size_t len, uint8_t* packed, uint8_t* codes );
+
+// Copies bytes first to last of each row into the matching column buffers, from the given offset, in cache sized tiles
+void transposeBytes( const uint8_t* rows, size_t rowCount, size_t stride, size_t first, size_t last, uint8_t* const* cols, size_t offset );
+
+// Expands packed bases into 2-bit codes a byte at a time; codes needs room for len rounded up to a multiple of 4
+void unpackBases( const uint8_t* packed, size_t len, uint8_t* codes );
+
+#endif /* PACK_BASES_H */
+
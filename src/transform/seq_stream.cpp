@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "seq_stream.h"
+#include "scheduler.h"
+#include <atomic>
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SEQ_BUFFER 1048576
+#define BGZF_BATCH 16
+
+SeqStream::SeqStream( string filename, int threadCount )
+: filename( filename ), gz( NULL ), bgzf( NULL ), pipe( NULL ), zs( NULL ), zsEnded( false ), buff( SEQ_BUFFER ), pBuff( 0 ), buffLen( 0 ), threadCount( max( 1, threadCount ) )
+{
+    // Standard input is always read as a stream, even when redirected from a file, as it cannot be reopened by name
+    if ( filename == "-" )
+    {
+        openPipe( stdin );
+        return;
+    }
+    
+    bgzf = fopen( filename.c_str(), "rb" );
+    if ( !bgzf )
+    {
+        cerr << "Error: could not open file \"" << filename << "\"" << endl;
+        exit( EXIT_FAILURE );
+    }
+    
+    struct stat st;
+    if ( fstat( fileno( bgzf ), &st ) || !S_ISREG( st.st_mode ) )
+    {
+        openPipe( bgzf );
+        bgzf = NULL;
+        return;
+    }
+    
+    // BGZF files are gzip members carrying their own compressed size in a "BC" extra field
+    vector<uint8_t> head;
+    if ( bgzfHeader( head ) )
+    {
+        rewind( bgzf );
+        return;
+    }
+    
+    // Anything else is left to zlib, which also passes uncompressed files through unchanged
+    fclose( bgzf );
+    bgzf = NULL;
+    openGz( open( filename.c_str(), O_RDONLY ) );
+}
+
+SeqStream::~SeqStream()
+{
+    if ( gz ) gzclose( gz );
+    if ( bgzf ) fclose( bgzf );
+    if ( pipe && pipe != stdin ) fclose( pipe );
+    if ( zs ) inflateEnd( zs );
+    delete zs;
+}
+
+size_t SeqStream::bgzfHeader( vector<uint8_t> &head )
+{
+    // Reads a gzip member's header up to the end of its extra field, returning the member's size from its "BC" subfield, or 0 if it has none
+    head.resize( 12 );
+    if ( fread( head.data(), 1, 12, bgzf ) != 12 || head[0] != 31 || head[1] != 139 || head[2] != 8 || !( head[3] & 4 ) ) return 0;
+    size_t xlen = head[10] | ( head[11] << 8 );
+    head.resize( 12 + xlen );
+    if ( fread( &head[12], 1, xlen, bgzf ) != xlen ) return 0;
+    for ( size_t p = 12; p + 4 <= head.size(); p += 4 + ( head[p+2] | ( head[p+3] << 8 ) ) )
+    {
+        if ( head[p] == 'B' && head[p+1] == 'C' && head[p+2] == 2 && !head[p+3] && p + 6 <= head.size() )
+        {
+            return ( head[p+4] | ( head[p+5] << 8 ) ) + 1;
+        }
+    }
+    return 0;
+}
+
+void SeqStream::openGz( int fd )
+{
+    gz = fd < 0 ? NULL : gzdopen( fd, "rb" );
+    if ( !gz )
+    {
+        cerr << "Error: could not open file \"" << filename << "\"" << endl;
+        exit( EXIT_FAILURE );
+    }
+    gzbuffer( gz, SEQ_BUFFER );
+}
+
+void SeqStream::openPipe( FILE* fp )
+{
+    // The bytes read to tell gzip from plain text cannot be put back, so they start either the text or the input to inflate
+    pipe = fp;
+    buffLen = fread( buff.data(), 1, 2, pipe );
+    if ( buffLen < 2 || (uint8_t)buff[0] != 31 || (uint8_t)buff[1] != 139 ) return;
+    
+    raw.resize( SEQ_BUFFER );
+    raw[0] = 31;
+    raw[1] = 139;
+    buffLen = 0;
+    zs = new z_stream;
+    memset( zs, 0, sizeof( z_stream ) );
+    zs->next_in = raw.data();
+    zs->avail_in = 2;
+    if ( inflateInit2( zs, 15 + 16 ) != Z_OK )
+    {
+        cerr << "Error: could not decompress file \"" << filename << "\"" << endl;
+        exit( EXIT_FAILURE );
+    }
+}
+
+bool SeqStream::fill()
+{
+    // Appends more of the file behind whatever is left in the buffer; false at the end of the file
+    if ( bgzf ) return fillBgzf();
+    if ( pipe ) return fillPipe();
+    
+    // A gzip member cut short reads as the end of the file, flagged only by a buffer error
+    int n = gzread( gz, &buff[buffLen], buff.size() - buffLen ), err = Z_OK;
+    if ( n <= 0 ) gzerror( gz, &err );
+    if ( n < 0 || err == Z_BUF_ERROR )
+    {
+        cerr << "Error: could not decompress file \"" << filename << "\": " << gzerror( gz, &err ) << endl;
+        exit( EXIT_FAILURE );
+    }
+    buffLen += n;
+    return n;
+}
+
+bool SeqStream::fillBgzf()
+{
+    // Read a batch of whole blocks, then inflate one block per job
+    vector< vector<uint8_t> > blocks;
+    vector<size_t> starts;
+    long plain = -1;
+    while ( blocks.size() < BGZF_BATCH * threadCount )
+    {
+        int c = fgetc( bgzf );
+        if ( c == EOF ) break;
+        ungetc( c, bgzf );
+        long pos = ftell( bgzf );
+        vector<uint8_t> block;
+        size_t blockSize = bgzfHeader( block );
+        if ( !blockSize )
+        {
+            plain = pos;
+            break;
+        }
+        size_t start = block.size();
+        if ( blockSize < start + 8 )
+        {
+            cerr << "Error: invalid BGZF block in file \"" << filename << "\"" << endl;
+            exit( EXIT_FAILURE );
+        }
+        block.resize( blockSize );
+        if ( fread( &block[start], 1, blockSize - start, bgzf ) != blockSize - start )
+        {
+            cerr << "Error: truncated BGZF block in file \"" << filename << "\"" << endl;
+            exit( EXIT_FAILURE );
+        }
+        blocks.push_back( block );
+        starts.push_back( start );
+    }
+    
+    // A member that cannot be framed by its "BC" subfield leaves it and the rest of the file to zlib
+    if ( plain >= 0 )
+    {
+        int fd = dup( fileno( bgzf ) );
+        fclose( bgzf );
+        bgzf = NULL;
+        if ( fd >= 0 && lseek( fd, plain, SEEK_SET ) != plain )
+        {
+            close( fd );
+            fd = -1;
+        }
+        openGz( fd );
+    }
+    if ( blocks.empty() ) return !bgzf && fill();
+    
+    // Each block ends with the CRC and length of its inflated data
+    vector<size_t> offsets( blocks.size() + 1, buffLen );
+    for ( size_t i = 0; i < blocks.size(); i++ )
+    {
+        uint8_t* tail = &blocks[i].end()[-4];
+        offsets[i+1] = offsets[i] + ( tail[0] | ( tail[1] << 8 ) | ( tail[2] << 16 ) | ( (uint32_t)tail[3] << 24 ) );
+    }
+    buff.resize( max( buff.size(), offsets.back() ) );
+    
+    atomic<bool> failed( false );
+    WorkScheduler::run( blocks.size(), threadCount, [&]( size_t i )
+    {
+        vector<uint8_t> &block = blocks[i];
+        uint8_t* tail = &block.end()[-8];
+        uint32_t crc = tail[0] | ( tail[1] << 8 ) | ( tail[2] << 16 ) | ( (uint32_t)tail[3] << 24 );
+        uInt outLen = offsets[i+1] - offsets[i];
+        Bytef* out = (Bytef*)buff.data() + offsets[i];
+        
+        z_stream zs;
+        memset( &zs, 0, sizeof( zs ) );
+        zs.next_in = &block[ starts[i] ];
+        zs.avail_in = block.size() - starts[i] - 8;
+        zs.next_out = out;
+        zs.avail_out = outLen;
+        bool ok = inflateInit2( &zs, -15 ) == Z_OK;
+        ok = ok && inflate( &zs, Z_FINISH ) == Z_STREAM_END && !zs.avail_out;
+        inflateEnd( &zs );
+        if ( !ok || crc32( crc32( 0, NULL, 0 ), out, outLen ) != crc ) failed = true;
+    } );
+    
+    if ( failed )
+    {
+        cerr << "Error: could not decompress file \"" << filename << "\"" << endl;
+        exit( EXIT_FAILURE );
+    }
+    
+    // An empty end-of-file block adds nothing, so move on to the next batch
+    bool added = offsets.back() > buffLen;
+    buffLen = offsets.back();
+    return added || fill();
+}
+
+bool SeqStream::fillPipe()
+{
+    if ( !zs )
+    {
+        size_t n = fread( &buff[buffLen], 1, buff.size() - buffLen, pipe );
+        buffLen += n;
+        return n;
+    }
+    
+    // Concatenated gzip members, including BGZF blocks, are inflated in turn on this thread
+    size_t start = buffLen;
+    while ( buffLen == start )
+    {
+        if ( !zs->avail_in )
+        {
+            zs->next_in = raw.data();
+            zs->avail_in = fread( raw.data(), 1, raw.size(), pipe );
+            
+            // Input may only run out between members, never partway through one
+            if ( !zs->avail_in && !zsEnded )
+            {
+                cerr << "Error: could not decompress file \"" << filename << "\"" << endl;
+                exit( EXIT_FAILURE );
+            }
+            if ( !zs->avail_in ) break;
+        }
+        zs->next_out = (Bytef*)&buff[buffLen];
+        zs->avail_out = buff.size() - buffLen;
+        int ret = inflate( zs, Z_NO_FLUSH );
+        buffLen = buff.size() - zs->avail_out;
+        zsEnded = ret == Z_STREAM_END;
+        if ( ret == Z_STREAM_END ) inflateReset( zs );
+        else if ( ret != Z_OK && ret != Z_BUF_ERROR )
+        {
+            cerr << "Error: could not decompress file \"" << filename << "\"" << endl;
+            exit( EXIT_FAILURE );
+        }
+    }
+    return buffLen > start;
+}
+
+bool SeqStream::getLine( const char* &line, size_t &len )
+{
+    // The line is left in the buffer, valid until the next call
+    for ( size_t from = pBuff;; )
+    {
+        char* nl = (char*)memchr( buff.data() + from, '\n', buffLen - from );
+        if ( nl )
+        {
+            line = buff.data() + pBuff;
+            len = nl - line;
+            pBuff += len + 1;
+            return true;
+        }
+        
+        // A line running past the buffer is moved to its front, and more of the file is read in behind it
+        from = buffLen - pBuff;
+        memmove( buff.data(), buff.data() + pBuff, from );
+        pBuff = 0;
+        buffLen = from;
+        if ( buffLen == buff.size() ) buff.resize( buff.size() * 2 );
+        if ( !fill() )
+        {
+            line = buff.data();
+            len = buffLen;
+            pBuff = buffLen;
+            return len;
+        }
+    }
+}
+
+bool SeqStream::getLine( string &line )
+{
+    const char* p;
+    size_t len;
+    if ( !getLine( p, len ) ) return false;
+    line.assign( p, len );
+    return true;
+}
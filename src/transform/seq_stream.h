@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEQ_STREAM_H
+#define SEQ_STREAM_H
+
+#include "types.h"
+#include <cstdio>
+#include <zlib.h>
+
+// Reads the lines of a plain or gzip-compressed sequence file; BGZF blocks are inflated in parallel
+// A file name of "-" reads standard input, and pipes are read as a stream that is never rewound
+struct SeqStream
+{
+    SeqStream( string filename, int threadCount );
+    ~SeqStream();
+    
+    bool getLine( const char* &line, size_t &len );
+    bool getLine( string &line );
+    
+private:
+    size_t bgzfHeader( vector<uint8_t> &head );
+    bool fill();
+    bool fillBgzf();
+    bool fillPipe();
+    void openGz( int fd );
+    void openPipe( FILE* fp );
+    
+    string filename;
+    gzFile gz;
+    FILE* bgzf,* pipe;
+    z_stream* zs;
+    bool zsEnded;
+    vector<uint8_t> raw;
+    vector<char> buff;
+    size_t pBuff, buffLen;
+    int threadCount;
+};
+
+#endif /* SEQ_STREAM_H */
+
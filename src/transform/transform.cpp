@@ -19,23 +19,116 @@
  */
 
 #include "transform.h"
+#include "scheduler.h"
 #include <iostream>
 #include <fstream>
 #include <sys/stat.h>
 #include <string.h>
 #include <cassert>
 #include <algorithm>
+#include <thread>
+#include <mutex>
 //#include <chrono>
 //#include <iomanip>
 
-void Transform::load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, uint8_t pairedLibCount, bool revComp )
+static bool fillBatches( vector<ReadFile*> &lib, vector<ReadBatch> &batches )
+{
+    // Take the next records of a library in order; false once the library is spent
+    for ( ReadBatch &batch : batches )
+    {
+        batch.count = 0;
+        for ( int j ( 0 ); j < 2; j++ )
+        {
+            batch.text[j].clear();
+            batch.records[j].clear();
+        }
+    }
+    for ( ReadBatch &batch : batches )
+    {
+        for ( ; batch.count < READ_BATCH; batch.count++ )
+        {
+            if ( !lib[0]->getRecord( batch.text[0], batch.records[0] ) ) return false;
+            if ( lib.size() == 2 && !lib[1]->getRecord( batch.text[1], batch.records[1] ) ) return false;
+        }
+    }
+    return true;
+}
+
+static void parseBatch( vector<ReadFile*> &lib, ReadBatch &batch, BinaryWriter* binWrite, uint8_t minLen )
+{
+    batch.clear();
+    batch.lines.reserve( batch.count * lib.size() * binWrite->lineLen );
+    auto encode = [&]( int j, ReadRecord &rec, vector<uint8_t> &lines )
+    {
+        lines.resize( lines.size() + binWrite->lineLen );
+        binWrite->encode( &batch.text[j][rec.seq], rec.seqLen, &lines.end()[ -binWrite->lineLen ], batch.charPlaceCounts, batch.readLens );
+    };
+    
+    for ( ReadId i = 0; i < batch.count; i++ )
+    {
+        ReadRecord* recs[2] = { &batch.records[0][i], lib.size() == 2 ? &batch.records[1][i] : NULL };
+        for ( int j ( 0 ); j < lib.size(); j++ ) lib[j]->clean( batch.text[j].data(), *recs[j] );
+        
+        // Pairs with a mate that is too short keep the other mate as a single read
+        if ( lib.size() == 2 && recs[0]->seqLen >= minLen && recs[1]->seqLen >= minLen )
+        {
+            encode( 0, *recs[0], batch.lines );
+            encode( 1, *recs[1], batch.lines );
+            batch.written += 2;
+        }
+        else if ( lib.size() == 2 )
+        {
+            batch.discarded += 2;
+            for ( int j ( 0 ); j < 2; j++ )
+            {
+                if ( recs[j]->seqLen < minLen ) continue;
+                encode( j, *recs[j], batch.singleLines );
+                --batch.discarded;
+            }
+        }
+        else if ( recs[0]->seqLen >= minLen )
+        {
+            encode( 0, *recs[0], batch.lines );
+            batch.written++;
+        }
+        else batch.discarded++;
+    }
+}
+
+static void loadLibrary( vector<ReadFile*> &lib, BinaryWriter* binWrite, uint8_t minLen, int threadCount, ReadId &thisReadCount, ReadId &discardCount )
+{
+    // The next batches are read while the current ones are parsed and encoded on every thread, then written in order
+    vector<ReadBatch> batches[2];
+    for ( int i ( 0 ); i < 2; i++ ) batches[i].resize( threadCount * 2, ReadBatch( binWrite->readLen ) );
+    bool more = fillBatches( lib, batches[0] );
+    for ( int b = 0;; b = !b )
+    {
+        bool nextMore = false;
+        thread reader;
+        if ( more ) reader = thread( [&](){ nextMore = fillBatches( lib, batches[!b] ); } );
+        
+        WorkScheduler::run( batches[b].size(), threadCount, [&]( size_t i ){ parseBatch( lib, batches[b][i], binWrite, minLen ); } );
+        for ( ReadBatch &batch : batches[b] )
+        {
+            binWrite->write( batch );
+            thisReadCount += lib.size() == 2 ? batch.written : batch.count;
+            discardCount += batch.discarded;
+        }
+        
+        if ( !more ) break;
+        reader.join();
+        more = nextMore;
+    }
+}
+
+void Transform::load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, uint8_t pairedLibCount, bool revComp, bool packIds, bool collapseDupes, int threadCount )
 {
     sort( libs.begin(), libs.end(), []( vector<ReadFile*> &a, vector<ReadFile*> &b ){
         return a.size() > b.size();
     } );
     
     // Set base read length
-    uint8_t readLen = 0;
+    uint16_t readLen = 0;
     for ( vector<ReadFile*> &lib : libs )
     {
         for ( ReadFile* readFile : lib )
@@ -44,18 +137,17 @@ void Transform::load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, u
         }
     }
     uint8_t minLen = 45;
-    assert( readLen >= 80 && readLen <= 255 );
+    assert( readLen >= 80 && readLen <= MAX_READ_LEN );
     
     cout << "    Read length set to " << to_string( readLen ) << "." << endl;
     cout << "    Min length set to " << to_string( minLen ) << "." << endl;
 
-    ofstream tmpSingles = fns->getWriteStream( fns->tmpSingles );
     ReadId readCount = 0, discardCount = 0;
     uint8_t fileCount = 0;
     double readStartTime = clock();
 //    auto t_start = std::chrono::high_resolution_clock::now();
     
-    BinaryWriter* binWrite = new BinaryWriter( fns, pairedLibCount, readLen, revComp );
+    BinaryWriter* binWrite = new BinaryWriter( fns, pairedLibCount, readLen, revComp, packIds, collapseDupes );
     
     // Write binary sequence file and first transform cycle
     while ( !libs.empty() )
@@ -65,45 +157,14 @@ void Transform::load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, u
         // Process paired libraries
         if ( libs[0].size() == 2 )
         {
-            string reads[2];
-            while ( libs[0][0]->getNext( reads[0] ) && libs[0][1]->getNext( reads[1] ) )
-            {
-                if ( reads[0].length() >= minLen && reads[1].length() >= minLen )
-                {
-                    binWrite->write( reads[0] );
-                    binWrite->write( reads[1] );
-                    thisReadCount += 2;
-                }
-                else
-                {
-                    discardCount += 2;
-                    if ( reads[0].length() >= minLen )
-                    {
-                        tmpSingles << reads[0] << '\n';
-                        --discardCount;
-                    }
-                    if ( reads[1].length() >= minLen )
-                    {
-                        tmpSingles << reads[1] << '\n';
-                        --discardCount;
-                    }
-                }
-            }
-            
+            loadLibrary( libs[0], binWrite, minLen, threadCount, thisReadCount, discardCount );
             binWrite->setNextLibrary();
             
             fileCount += libs[0][0] == libs[0][1] ? 1 : 2;
             delete libs[0][0];
             if ( libs[0][1] != libs[0][0] ) delete libs[0][1];
             
-            if ( libs.size() == 1 || libs[1].size() == 1 )
-            {
-                fileCount += libs.size() - 1;
-                tmpSingles.close();
-                ReadFile* readFile = new ReadFile( fns->tmpSingles, readLen, 0 );
-                vector<ReadFile*> lib = { readFile };
-                libs.push_back( lib );
-            }
+            if ( libs.size() == 1 || libs[1].size() == 1 ) fileCount += libs.size() - 1;
             
             cout << "\tRead " << to_string( thisReadCount ) << " paired reads from library" << endl;
         }
@@ -111,19 +172,8 @@ void Transform::load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, u
         // Process singleton libraries
         else if ( libs[0].size() == 1 )
         {
-            string read;
-            while ( libs[0][0]->getNext( read ) )
-            {
-                if ( read.length() >= minLen )
-                {
-                    binWrite->write( read );
-                }
-                else
-                {
-                    discardCount++;
-                }
-                thisReadCount++;
-            }
+            loadLibrary( libs[0], binWrite, minLen, threadCount, thisReadCount, discardCount );
+            binWrite->clearDupes();
             delete libs[0][0];
             
             if ( thisReadCount )
@@ -135,11 +185,19 @@ void Transform::load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, u
         libs.erase( libs.begin() );
         readCount += thisReadCount;
     }
+    
+    // Mates left single by their pairs follow the single libraries
+    if ( ReadId singleCount = binWrite->writeSingles() )
+    {
+        cout << "\tRead " << to_string( singleCount ) << " single reads" << endl;
+        readCount += singleCount;
+    }
     binWrite->close();
     
     cout << endl << "Reading inputs files... completed!" << endl << endl;
     cout << "Summary:" << endl;
     cout << "Read in " << to_string( readCount ) << " sequence reads and discarded " << to_string( discardCount ) << endl;
+    if ( collapseDupes ) cout << "Kept " << to_string( readCount - binWrite->dupCount ) << " distinct reads and collapsed " << to_string( binWrite->dupCount ) << " duplicate reads into them." << endl;
     cout << "Read from " << to_string( fileCount ) << " read files, including " << to_string( pairedLibCount ) << " paired libraries." << endl;
     cout << "Time taken: " << getDuration( readStartTime );
 //    cout << "   " << std::fixed << std::setprecision(2) << ( clock() - readStartTime ) / CLOCKS_PER_SEC << " vs " << ( ( std::chrono::high_resolution_clock::now() - t_start ).count() / 1000.0 ) / CLOCKS_PER_SEC << endl << endl;
@@ -147,38 +205,86 @@ void Transform::load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, u
     delete binWrite;
 }
 
-void Transform::run( PreprocessFiles* fns )
+void Transform::run( PreprocessFiles* fns, int threadCount, bool asyncIo, int chunkCount )
 {
     cout << "Preprocessing step 2 of 3: transforming sequence data..." << endl << endl;
     
-    BinaryReader* bin = new BinaryReader( fns );
-    BwtCycler* cycler = new BwtCycler( fns );
+    IoRing probe;
+    if ( asyncIo && !probe.init( 1 ) )
+    {
+        cout << "    Asynchronous I/O is not available on this system; using blocking I/O instead." << endl << endl;
+        asyncIo = false;
+    }
+    else if ( asyncIo && fns->scratch )
+    {
+        cout << "    Asynchronous I/O does not apply within scratch files; using blocking I/O instead." << endl << endl;
+        asyncIo = false;
+    }
+    
     double totalStart = clock();
 //    auto t_start = std::chrono::high_resolution_clock::now();
     
+    // A transform already under way without chunks carries on without them
+    ChunkTransform* chunked = chunkCount > 1 ? new ChunkTransform( fns, chunkCount ) : NULL;
+    if ( chunked && chunked->chunks.size() > 1 && chunked->cycle < 2 ) runChunks( chunked, threadCount, asyncIo );
+    else runCycles( fns, threadCount, asyncIo, false );
+    if ( chunked ) delete chunked;
+    
+    cout << endl << "Transforming sequence data... completed!" << endl;
+    cout << "Time taken: " << getDuration( totalStart );
+//    cout << "   " << std::fixed << std::setprecision(2) << ( clock() - totalStart ) / CLOCKS_PER_SEC << " vs " << ( ( std::chrono::high_resolution_clock::now() - t_start ).count() / 1000.0 ) / CLOCKS_PER_SEC << endl << endl;
+    cout << endl << endl;
+}
+
+void Transform::runChunks( ChunkTransform* chunked, int threadCount, bool asyncIo )
+{
+    // Chunks are transformed side by side, sharing the threads between them
+    size_t chunkCount = chunked->chunks.size();
+    int sideBySide = min( (int)chunkCount, threadCount ), chunkThreads = max( 1, threadCount / sideBySide );
+    mutex coutLock;
+    WorkScheduler::run( chunkCount, sideBySide, [&]( size_t i ){
+        if ( chunked->prep( i ) ) runCycles( chunked->chunks[i], chunkThreads, asyncIo, true );
+        lock_guard<mutex> guard( coutLock );
+        cout << "    Chunk " << to_string( i + 1 ) << " of " << to_string( chunkCount ) << "... completed" << endl;
+    } );
+    
+    double mergeStart = clock();
+    cout << "    Merging " << to_string( chunkCount ) << " chunks... " << flush;
+    chunked->merge( threadCount );
+    chunked->finish();
+    chunked->fns->clean( true );
+    cout << " completed in " << getDuration( mergeStart ) << endl;
+}
+
+void Transform::runCycles( PreprocessFiles* fns, int threadCount, bool asyncIo, bool isChunk )
+{
+    // Chunks report nothing of their own, and have no singles file to remove
+    BinaryReader* bin = new BinaryReader( fns );
+    BwtCycler* cyclers[4];
+    for ( int i = 0; i < 4; i++ ) cyclers[i] = new BwtCycler( fns, i, bin->idBits, asyncIo );
+    
     while ( bin->cycle < bin->readLen )
     {
         double cycleStart = clock();
-        cout << "    Cycle " << to_string( bin->cycle ) << " of " << to_string( bin->readLen ) << "... " << flush;
+        if ( !isChunk ) cout << "    Cycle " << to_string( bin->cycle ) << " of " << to_string( bin->readLen ) << "... " << flush;
         
         bin->read();
-        cycler->run( bin->chars, ( bin->anyEnds ? bin->ends : NULL ), bin->cycle );
-        bin->update();
+        bin->prefetch();
+        BwtCycler::run( cyclers, bin->chars, ( bin->anyEnds ? bin->ends : NULL ), bin->cycle, threadCount );
         
-        cout << " completed in " << getDuration( cycleStart ) << endl;
+        // Cycles held in memory would be lost on a crash, so a resume restarts from the last cycle left on disk; scratch maps are saved first so that it finds them
+        if ( fns->scratch ) fns->scratch->save();
+        if ( !fns->mem ) bin->update();
+        
+        if ( !isChunk ) cout << " completed in " << getDuration( cycleStart ) << endl;
     }
     
     double finalStart = clock();
-    cout << "    Cycle " << to_string( bin->cycle ) << " of " << to_string( bin->readLen ) << "... " << flush;
-    cycler->finish( bin->cycle + 1 );
-    cout << " completed in " << getDuration( finalStart ) << endl;
+    if ( !isChunk ) cout << "    Cycle " << to_string( bin->cycle ) << " of " << to_string( bin->readLen ) << "... " << flush;
+    BwtCycler::finish( cyclers, bin->cycle + 1, threadCount );
+    if ( !isChunk ) cout << " completed in " << getDuration( finalStart ) << endl;
     bin->finish();
-    fns->clean();
+    fns->clean( isChunk );
     delete bin;
-    delete cycler;
-    
-    cout << endl << "Transforming sequence data... completed!" << endl;
-    cout << "Time taken: " << getDuration( totalStart );
-//    cout << "   " << std::fixed << std::setprecision(2) << ( clock() - totalStart ) / CLOCKS_PER_SEC << " vs " << ( ( std::chrono::high_resolution_clock::now() - t_start ).count() / 1000.0 ) / CLOCKS_PER_SEC << endl << endl;
-    cout << endl << endl;
+    for ( int i = 0; i < 4; i++ ) delete cyclers[i];
 }
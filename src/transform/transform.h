@@ -26,13 +26,17 @@
 #include "transform_structs.h"
 #include "transform_binary.h"
 #include "transform_bwt.h"
+#include "transform_chunks.h"
 
 class Transform 
 {
 public:
-    static void load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, uint8_t pairedLibCount, bool revComp );
-    static void run( PreprocessFiles* fns );
+    static void load( PreprocessFiles* fns, vector< vector<ReadFile*> >& libs, uint8_t pairedLibCount, bool revComp, bool packIds, bool collapseDupes, int threadCount );
+    static void run( PreprocessFiles* fns, int threadCount, bool asyncIo, int chunkCount );
     
+private:
+    static void runChunks( ChunkTransform* chunked, int threadCount, bool asyncIo );
+    static void runCycles( PreprocessFiles* fns, int threadCount, bool asyncIo, bool isChunk );
 };
 
 #endif /* TRANSFORM_H */
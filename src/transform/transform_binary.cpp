@@ -20,9 +20,13 @@
 
 #include "transform_binary.h"
 #include "filenames.h"
+#include "pack_bases.h"
+#include "shared_functions.h"
 #include <cassert>
 #include <iostream>
+#include <limits>
 #include <string.h>
+#include <unistd.h>
 //#include <chrono>
 //#include <iomanip>
 
@@ -33,19 +37,30 @@ BinaryReader::BinaryReader( PreprocessFiles* filenames )
     bin = fns->getReadPointer( fns->bin, false );
     fread( &seqsBegin, 1, 1, bin );
     fread( &id, 8, 1, bin );
-    fread( &readLen, 1, 1, bin );
-    fread( &cycle, 1, 1, bin );
+    readBinaryLength( bin, seqsBegin, readLen, cycle );
+    fseek( bin, 11, SEEK_SET );
     fread( &revComp, 1, 1, bin );
+    uint8_t libCount;
+    fseek( bin, 20, SEEK_SET );
+    fread( &libCount, 1, 1, bin );
     fseek( bin, 16, SEEK_SET );
-    fread( &seqCount, 4, 1, bin );
+    seqCount = readBinaryCount( bin, 21 + libCount * 12 );
     
-    lineLen = 1 + ( readLen + 3 ) / 4;
+    lenBytes = readLen > 255 ? 2 : 1;
+    lineLen = lenBytes + ( readLen + 3 ) / 4;
     fileSize = (CharId)seqCount * (CharId)lineLen;
     buffSize = 16777216 - ( 16777216 % lineLen );
     charSize = ( seqCount + 3 ) / 4;
     buff = new uint8_t[buffSize];
-    chars = new uint8_t[ ( seqCount + 3 ) / 4 ];
+    for ( int i ( 0 ); i < 2; i++ )
+    {
+        slotChars[i] = new uint8_t[charSize];
+        slotEnds[i] = NULL;
+        slotAnyEnds[i] = false;
+    }
+    chars = slotChars[0];
     ends = NULL;
+    anyEnds = false;
     
     for ( int i = 0; i < 8; i++ )
     {
@@ -69,19 +84,21 @@ BinaryReader::BinaryReader( PreprocessFiles* filenames )
     }
     chr = fns->getReadPointer( fns->tmpChr, false );
     trm = fns->getReadPointer( fns->tmpTrm, false );
-    
-    CharId trimSkip = trmBegin;
-    if ( cycle >= minTrim ) for ( int i = 0; i < ( cycle+1-minTrim ); i++ ) trimSkip += trimCounts[i]*4;
     assert( !trimCounts.empty() || minTrim == readLen );
-    if ( !trimCounts.empty() ) fseek( trm, trimSkip, SEEK_SET );
-    if ( cycle > 2 ) fseek( chr, ( cycle-2 ) * charSize, SEEK_SET );
+    
+    // Init leaves cycle 2 in its slot; a resume loads its next cycle afresh
+    loaded = max( cycle, uint16_t( 2 ) );
 }
 
 BinaryReader::~BinaryReader()
 {
-    if ( chars ) delete chars;
+    if ( loader.joinable() ) loader.join();
     if ( buff ) delete buff;
-    if ( ends ) delete ends;
+    for ( int i ( 0 ); i < 2; i++ )
+    {
+        delete[] slotChars[i];
+        if ( slotEnds[i] ) delete[] slotEnds[i];
+    }
     chars = buff = ends = NULL;
 }
 
@@ -96,23 +113,27 @@ void BinaryReader::init()
 {
     fseek( bin, seqsBegin, SEEK_SET );
     cycle = 1;
-    FILE* ids[4][4];
+    
+    // Ids are staged per bucket and written a full buffer at a time
+    IdWriter ids[4][4];
     for ( int i( 0 ); i < 4; i++ ) for ( int j( 0 ); j < 4; j++ )
     {
-        ids[i][j] = fns->getReadPointer( fns->tmpIds[0][i][j], true );
-        fseek( ids[i][j], 4, SEEK_SET );
+        ids[i][j].open( fns->getEditPointer( fns->tmpIds[0][i][j][0] ), idBits );
+        fseek( ids[i][j].fp, sizeof( ReadId ), SEEK_SET );
     }
     
     uint8_t line[lineLen];
     ReadId p = 0, i = 0;
-    ReadId idsCounts[4][4]{0};
     
     {
-        ReadId blockSize = 8*1000, pChar = 0;
+        // Each tile row holds one byte of every cycle, from four reads or from two reads and their reverse complements
+        ReadId tileRows = 64, t = 0, pChar = 0;
+        ReadId blockSize = max( (CharId)tileRows, min( (CharId)1 << 20, ( (CharId)64 << 20 ) / readLen ) / tileRows * tileRows );
         CharId seeks[readLen];
-        uint8_t seq[readLen],* outs[readLen];
-        for ( uint8_t j = 0; j < readLen; j++ ) outs[j] = new uint8_t[blockSize]{0};
-        for ( uint8_t j = 3; j < readLen; j++ ) seeks[j] = ( j-3 ) * charSize;
+        uint8_t seq[readLen + 3],* outs[readLen];
+        vector<uint8_t> tile( tileRows * readLen, 0 );
+        for ( uint16_t j = 3; j < readLen; j++ ) outs[j] = new uint8_t[blockSize];
+        for ( uint16_t j = 3; j < readLen; j++ ) seeks[j] = ( j-3 ) * charSize;
         
         chr = fns->getWritePointer( fns->tmpChr );
         fseek( chr, CharId( readLen-3 ) * charSize - 1, SEEK_SET );
@@ -124,93 +145,97 @@ void BinaryReader::init()
         int pTrim[readLen-minTrim]{0};
         ReadId* bufTrim[readLen-minTrim], totalTrims = 0;
         CharId fpTrims[readLen-minTrim];
-        for ( uint8_t j = 0; j+minTrim < readLen; j++ )
+        for ( uint16_t j = 0; j+minTrim < readLen; j++ )
         {
-            fpTrims[j] = j ? fpTrims[j-1] + ( trimCounts[j-1] * 4 ) : trmBegin;
+            fpTrims[j] = j ? fpTrims[j-1] + ( trimCounts[j-1] * sizeof( ReadId ) ) : trmBegin;
             bufTrim[j] = new ReadId[1000];
             totalTrims += trimCounts[j];
         }
         
         trm = fns->getReadPointer( fns->tmpTrm, true );
-        fseek( trm, CharId( totalTrims ) * 4 - 1 + trmBegin, SEEK_SET );
+        fseek( trm, CharId( totalTrims ) * sizeof( ReadId ) - 1 + trmBegin, SEEK_SET );
         fwrite( line, 1, 1, trm );
+        
+        // Full tiles are transposed into the column blocks, and full blocks written to each cycle's place in the file
+        auto flushTile = [&]()
+        {
+            for ( ReadId r = 0; r < t; r++ ) chars[pChar++] = tile[ r * readLen + 2 ];
+            transposeBytes( tile.data(), t, readLen, 3, readLen, outs, p );
+            memset( tile.data(), 0, t * readLen );
+            p += t;
+            t = 0;
+        };
+        auto flushBlock = [&]()
+        {
+            for ( uint16_t j = 3; j < readLen; j++ )
+            {
+                pwrite( fileno( chr ), outs[j], p, seeks[j] );
+                seeks[j] += p;
+            }
+            p = 0;
+        };
 
+        CharId pBuff = 0, buffLen = 0;
         for ( ReadId id = 0; id < seqCount; id++ )
         {
-            if ( i == 4 )
+            if ( pBuff == buffLen )
             {
-                ++pChar;
-                if ( ++p == blockSize )
-                {
-                    for ( uint8_t j = 3; j < readLen; j++ )
-                    {
-                        fseek( chr, seeks[j], SEEK_SET );
-                        fwrite( outs[j], 1, p, chr );
-                        memset( outs[j], 0, p );
-                        seeks[j] += p;
-                    }
-                    p = 0;
-                }
-                i = 0;
+                buffLen = fread( buff, 1, buffSize, bin );
+                pBuff = 0;
             }
-            fread( line, 1, lineLen, bin );
+            uint8_t* line = buff + pBuff;
+            uint16_t len = lenBytes > 1 ? line[0] | ( line[1] << 8 ) : line[0];
+            pBuff += lineLen;
             
-            if ( line[0] < readLen )
+            if ( len < readLen )
             {
-                assert( line[0] >= minTrim );
-                uint8_t j = line[0] - minTrim;
+                assert( len >= minTrim );
+                uint16_t j = len - minTrim;
                 
                 if ( pTrim[j] == 1000 )
                 {
                     fseek( trm, fpTrims[j], SEEK_SET );
-                    fwrite( bufTrim[j], 4, pTrim[j], trm );
-                    fpTrims[j] += pTrim[j]*4;
+                    fwrite( bufTrim[j], sizeof( ReadId ), pTrim[j], trm );
+                    fpTrims[j] += pTrim[j]*sizeof( ReadId );
                     pTrim[j] = 0;
                 }
                 
                 bufTrim[j][ pTrim[j]++ ] = revComp ? ( id / 2 ) : id;
             }
             
-            uint8_t base = line[0]-1, nxt = line[0]-3;
-            for ( uint8_t j = nxt; j < line[0]; j++ ) seq[j] = byteToInt[ j&0x3 ][ line[1+j/4] ];
-            for ( uint8_t j = 0; j < nxt; j++ )
+            // A read's cycles run from its last base back to its first, and its reverse complement's from first to last
+            unpackBases( line + lenBytes, len, seq );
+            uint8_t* row = &tile[ t * readLen ];
+            for ( uint16_t k = 0; k < len; k++ ) row[k] |= seq[len-1-k] << ( 6 - 2*i );
+            ids[ seq[len-1] ][ seq[len-2] ].put( id );
+            
+            if ( revComp )
             {
-                seq[j] = byteToInt[ j&0x3 ][ line[1+j/4] ];
-                if ( !i ) outs[base-j][p] = intToByte[0][ seq[j] ];
-                else outs[base-j][p] |= intToByte[i][ seq[j] ];
+                ++id;
+                ++i;
+                for ( uint16_t k = 0; k < len; k++ ) row[k] |= ( 3-seq[k] ) << ( 6 - 2*i );
+                ids[ 3-seq[0] ][ 3-seq[1] ].put( id );
             }
-            if ( !i ) chars[pChar] = intToByte[0][ seq[nxt] ];
-            else chars[pChar] |= intToByte[i][ seq[nxt] ];
-            i++;
             
-            idsCounts[ seq[base] ][ seq[base-1] ]++;
-            fwrite( &id, 4, 1, ids[ seq[base] ][ seq[base-1] ] );
-
-            if ( !revComp ) continue;
-            
-            ++id;
-            for ( uint8_t j = 3; j < line[0]; j++ ) outs[j][p] |= intToByte[i][ 3-seq[j] ];
-            chars[pChar] |= intToByte[i++][ 3-seq[2] ];
-            idsCounts[ 3-seq[0] ][ 3-seq[1] ]++;
-            fwrite( &id, 4, 1, ids[ 3-seq[0] ][ 3-seq[1] ] );
+            if ( ++i < 4 ) continue;
+            i = 0;
+            if ( ++t == tileRows ) flushTile();
+            if ( p == blockSize ) flushBlock();
         }
         
-        if ( i ? ++p : p ) for ( uint8_t j = 3; j < readLen; j++ )
-        {
-            fseek( chr, seeks[j], SEEK_SET );
-            fwrite( outs[j], 1, p, chr );
-            seeks[j] += p;
-        }
+        if ( i ) t++;
+        flushTile();
+        if ( p ) flushBlock();
         
-        for ( uint8_t j = 0; j+minTrim < readLen; j++ ) if ( pTrim[j] )
+        for ( uint16_t j = 0; j+minTrim < readLen; j++ ) if ( pTrim[j] )
         {
             fseek( trm, fpTrims[j], SEEK_SET );
-            fwrite( bufTrim[j], 4, pTrim[j], trm );
-            fpTrims[j] += pTrim[j]*4;
+            fwrite( bufTrim[j], sizeof( ReadId ), pTrim[j], trm );
+            fpTrims[j] += pTrim[j]*sizeof( ReadId );
         }
         
-        for ( uint8_t j = 0; j < readLen; j++ ) delete outs[j];
-        for ( uint8_t j = 0; j+minTrim < readLen; j++ ) delete bufTrim[j];
+        for ( uint16_t j = 3; j < readLen; j++ ) delete[] outs[j];
+        for ( uint16_t j = 0; j+minTrim < readLen; j++ ) delete bufTrim[j];
         
         fclose( chr );
         fclose( trm );
@@ -218,17 +243,18 @@ void BinaryReader::init()
     
     for ( int i = 0; i < 4; i++ ) for ( int j = 0; j < 4; j++ )
     {
-        fseek( ids[i][j], 0, SEEK_SET );
-        fwrite( &idsCounts[i][j], 4, 1, ids[i][j] );
-        fclose( ids[i][j] );
+        ids[i][j].flush();
+        fseek( ids[i][j].fp, 0, SEEK_SET );
+        fwrite( &ids[i][j].count, sizeof( ReadId ), 1, ids[i][j].fp );
+        fclose( ids[i][j].fp );
     }
     
     // Set inserts
     for ( int i = 0; i < 4; i++ )
     {
-        FILE* ins = fns->getReadPointer( fns->tmpIns[0][i], true );
+        FILE* ins = fns->getEditPointer( fns->tmpIns[0][i][0] );
         
-        CharId maxCount = max( idsCounts[i][0], max( idsCounts[i][1], max( idsCounts[i][2], idsCounts[i][3] ) ) );
+        CharId maxCount = max( ids[i][0].count, max( ids[i][1].count, max( ids[i][2].count, ids[i][3].count ) ) );
         CharId thisMax = 255;
         uint8_t sapByte = 0;
         while ( maxCount > thisMax )
@@ -247,45 +273,102 @@ void BinaryReader::init()
         {
             for ( uint8_t k = sapByte + 1; k--; )
             {
-                writeBuff[p++] = ( idsCounts[i][j] >> ( 8 * k ) ) & uint8_t(255);
+                writeBuff[p++] = ( ids[i][j].count >> ( 8 * k ) ) & uint8_t(255);
             }
         }
         fwrite( &writeBuff, 1, insCount, ins );
         fclose( ins );
     }
     
+    // All first cycle inserts sit in the first segment; the others start empty
+    for ( int i = 0; i < 4; i++ ) for ( int s = 0; s < 4; s++ )
+    {
+        CharId insCount = 0;
+        ReadId idsCount = 0;
+        if ( s )
+        {
+            FILE* ins = fns->getWritePointer( fns->tmpIns[0][i][s] );
+            fwrite( &insCount, 8, 1, ins );
+            fclose( ins );
+        }
+        for ( int j = 0; j < 5; j++ ) if ( s || j == 4 )
+        {
+            FILE* fp = fns->getWritePointer( fns->tmpIds[0][i][j][s] );
+            fwrite( &idsCount, sizeof( ReadId ), 1, fp );
+            fclose( fp );
+        }
+    }
+    
     // Set base BWT
-    FILE* bwt = fns->getWritePointer( fns->tmpBwt[0] );
     ReadId basePos[4]{0};
-    CharId charCounts[5]{0};
-    for ( int i = 0; i < 4; i++ ) for ( int j = 0; j < 4; j++ ) basePos[i] += idsCounts[i][j];
-    for ( int i = 0; i < 4; i++ ) charCounts[i] = basePos[i];
-    bool writeEndBwt = false;
-    CharId bwtCount = 0;
-    fwrite( &id, 8, 1, bwt );
-    fwrite( &writeEndBwt, 1, 1, bwt );
-    fwrite( &bwtCount, 8, 1, bwt );
-    fwrite( &charCounts, 8, 5, bwt );
-    fwrite( &basePos, 4, 4, bwt );
-    fclose( bwt );
-    
-    FILE* ends = fns->getWritePointer( fns->tmpEnd[0] );
-    ReadId endcount = 0;
-    fwrite( &endcount, 4, 1, ends );
-    fclose( ends );
+    for ( int i = 0; i < 4; i++ ) for ( int j = 0; j < 4; j++ ) basePos[i] += ids[i][j].count;
+    for ( int s = 0; s < 4; s++ )
+    {
+        FILE* bwt = fns->getWritePointer( fns->tmpBwt[0][s] );
+        CharId charCounts[5]{0};
+        if ( !s ) for ( int i = 0; i < 4; i++ ) charCounts[i] = basePos[i];
+        bool writeEndBwt = false;
+        CharId bwtCount = 0;
+        fwrite( &id, 8, 1, bwt );
+        fwrite( &writeEndBwt, 1, 1, bwt );
+        fwrite( &bwtCount, 8, 1, bwt );
+        fwrite( &charCounts, 8, 5, bwt );
+        fwrite( &basePos, sizeof( ReadId ), 4, bwt );
+        fclose( bwt );
+        
+        FILE* ends = fns->getWritePointer( fns->tmpEnd[0][s] );
+        ReadId endcount = 0;
+        fwrite( &endcount, sizeof( ReadId ), 1, ends );
+        fclose( ends );
+    }
     
 //    cout << std::fixed << std::setprecision(2) << " read: " << ( clock() - readStart ) / CLOCKS_PER_SEC << " vs " << ( ( std::chrono::high_resolution_clock::now() - t_start ).count() / 1000.0 ) / CLOCKS_PER_SEC << endl;
 }
 
+void BinaryReader::load( uint16_t c )
+{
+    // Reads the characters of cycle c and adds its trims to the ends of the cycle before it
+    uint8_t s = c % 2, prev = !s;
+    pread( fileno( chr ), slotChars[s], charSize, CharId( c - 3 ) * charSize );
+    
+    slotAnyEnds[s] = c >= minTrim;
+    if ( slotAnyEnds[s] )
+    {
+        CharId endsSize = ( seqCount + 15 ) / 16;
+        if ( !slotEnds[s] ) slotEnds[s] = new uint8_t[endsSize];
+        if ( slotAnyEnds[prev] ) memcpy( slotEnds[s], slotEnds[prev], endsSize );
+        else memset( slotEnds[s], 0, endsSize );
+        
+        int i = c - minTrim;
+        CharId trimSkip = trmBegin;
+        for ( int j = 0; j < i; j++ ) trimSkip += trimCounts[j]*sizeof( ReadId );
+        vector<ReadId> trims( trimCounts[i] );
+        pread( fileno( trm ), trims.data(), trimCounts[i]*sizeof( ReadId ), trimSkip );
+        for ( ReadId id : trims ) slotEnds[s][id/8] |= endBitArray[id % 8];
+    }
+    
+    loaded = c;
+}
+
+void BinaryReader::prefetch()
+{
+    // Loads the next cycle in the background while this cycle is transformed
+    if ( loader.joinable() ) loader.join();
+    if ( loaded > cycle || cycle + 1 >= readLen ) return;
+    loader = thread( [this](){ load( cycle + 1 ); } );
+}
+
 void BinaryReader::prep()
 {
     trm = fns->getReadPointer( fns->tmpTrm, true );
     fread( &trmBegin, 2, 1, trm );
+    minTrim = 0;
     fread( &minTrim, 1, 1, trm );
+    fread( &idBits, 1, 1, trm );
     ReadId inTrim;
-    for ( uint8_t j = 0; j+minTrim < readLen; j++ )
+    for ( uint16_t j = 0; j+minTrim < readLen; j++ )
     {
-        fread( &inTrim, 4, 1, trm );
+        fread( &inTrim, sizeof( ReadId ), 1, trm );
         trimCounts.push_back( inTrim );
     }
     fclose( trm );
@@ -293,51 +376,35 @@ void BinaryReader::prep()
 
 void BinaryReader::read()
 {
+    if ( loader.joinable() ) loader.join();
     prevEndCount = endCount;
     if ( ++cycle == readLen )
     {
-        delete[] chars;
         chars = NULL;
         return;
     }
-    if ( cycle == 2 ) return;
-    
-    double readStart = clock();
-//    auto t_start = std::chrono::high_resolution_clock::now();
-    
-    fread( chars, 1, charSize, chr );
-    
-    if ( anyEnds = ( cycle >= minTrim ) )
-    {
-        unordered_set<ReadId> ids;
-        for( ReadId in : {110803679,112732249,90490184,97199286,25558601,152543493,155562156,136293585,152034118,55435202,106260666,50802570,95519741,4171125,56612370,121848256,9567765,139030520,112612339,72400370,122625440,35006278,139506091,10585004,143005037,145942559,151231624,159486086} ) ids.insert( in / 2 );
-        if ( !ends ) ends = new uint8_t[ ( seqCount + 15 ) / 16 ]{0};
-        int i = cycle - minTrim;
-        ReadId id;
-        for ( ReadId j = 0; j < trimCounts[i]; j++ )
-        {
-            fread( &id, 4, 1, trm );
-            ends[id/8] |= endBitArray[id % 8];
-            endCount++;
-        }
-    }
     
-//    cout << std::fixed << std::setprecision(2) << " read: " << ( clock() - readStart ) / CLOCKS_PER_SEC << " vs " << ( ( std::chrono::high_resolution_clock::now() - t_start ).count() / 1000.0 ) / CLOCKS_PER_SEC << " ... " << flush;
+    // Cycle 2 was filled by init, any later cycle may already have been prefetched
+    if ( cycle > 2 && loaded < cycle ) load( cycle );
+    uint8_t s = cycle % 2;
+    chars = slotChars[s];
+    ends = slotEnds[s];
+    anyEnds = slotAnyEnds[s];
+    if ( anyEnds ) endCount += trimCounts[cycle - minTrim];
 }
 
 void BinaryReader::update()
 {
     FILE* fp = fns->getReadPointer( fns->bin, true );
-    fseek( fp, 10, SEEK_SET );
-    fwrite( &cycle, 1, 1, fp );
+    writeBinaryCycle( fp, seqsBegin, readLen, cycle );
     fclose( fp );
 }
 
-BinaryWriter::BinaryWriter( PreprocessFiles* filenames, uint8_t inLibCount, uint8_t inReadLen, bool revComp )
-: fns( filenames ), libCount( inLibCount ), readLen( inReadLen ), readLens( inReadLen, 0 ), libCounts( NULL ), revComp( revComp )
+BinaryWriter::BinaryWriter( PreprocessFiles* filenames, uint8_t inLibCount, uint16_t inReadLen, bool revComp, bool packIds, bool collapseDupes )
+: fns( filenames ), binRead( NULL ), libCount( inLibCount ), readLen( inReadLen ), readLens( inReadLen + 1, 0 ), libCounts( NULL ), revComp( revComp ), packIds( packIds ), collapseDupes( collapseDupes )
 {
     pBin = 0;
-    seqCount = 0;
+    seqCount = dupUnits = dupCount = 0;
     cycle = currLib = 0;
     
     srand( time(NULL) );
@@ -350,22 +417,27 @@ BinaryWriter::BinaryWriter( PreprocessFiles* filenames, uint8_t inLibCount, uint
     memset( &charCounts, 0, 40 );
 //    fns->setBinaryWrite( bin, bwt, ends, ins, ids );
     bin = fns->getBinary( false, false );
-    lineLen = 1 + ( readLen + 3 ) / 4;
+    singles = NULL;
+    singlesSpilt = 0;
+    lenBytes = readLen > 255 ? 2 : 1;
+    lineLen = lenBytes + ( readLen + 3 ) / 4;
     buffSize = 16777216 - ( 16777216 % lineLen );
     binBuff = new uint8_t[buffSize];
     
     if ( libCount ) libCounts = new ReadId[libCount]{0};
-    seqsBegin = 21 + ( libCount * 12 );
+    wideBegin = 21 + ( libCount * 12 );
+    seqsBegin = wideBegin + ( sizeof( ReadId ) > 4 ? 8 * ( libCount + 1 ) : 0 ) + ( readLen > 255 ? 4 : 0 );
     
     for ( int i = 0; i < 4; i++ ) for ( int j = 0; j < 4; j++ ) charPlaceCounts[i][j].resize( readLen, 0 );
     
-    uint8_t dummy8 = 0, revCal = revComp ? 2 : 0;
-    uint16_t dummy16 = 0;
+    uint8_t dummy8 = 0, revCal = revComp ? 2 : 0, len8 = readLen > 255 ? 0 : readLen;
+    uint16_t libSizes[3] = {};
+    uint8_t libType[2] = {};
     uint32_t dummy32 = 0;
     
     fwrite( &seqsBegin, 1, 1, bin );             // Byte offset of first sequence
     fwrite( &id, 8, 1, bin );                    // ID number for this transform session
-    fwrite( &readLen, 1, 1, bin );               // Read length
+    fwrite( &len8, 1, 1, bin );                  // Read length
     fwrite( &cycle, 1, 1, bin );                 // Current cycles complete
     fwrite( &revCal, 1, 1, bin );                // Is calibrated
     fwrite( &dummy32, 4, 1, bin );               // Estimated coverage
@@ -374,27 +446,51 @@ BinaryWriter::BinaryWriter( PreprocessFiles* filenames, uint8_t inLibCount, uint
     for ( int i ( 0 ); i < libCount; i++ )
     {
         fwrite( &dummy32, 4, 1, bin );           // Library sequence count
-        fwrite( &dummy16, 2, 3, bin );           // Library insert size estimates
-        fwrite( &dummy8, 1, 2, bin );            // Library type details
+        fwrite( &libSizes, 2, 3, bin );          // Library insert size estimates
+        fwrite( &libType, 1, 2, bin );           // Library type details
+    }
+    for ( int i ( wideBegin ); i < seqsBegin - ( readLen > 255 ? 4 : 0 ); i++ )
+    {
+        fwrite( &dummy8, 1, 1, bin );            // Counts too large for their 4 byte slots
+    }
+    if ( readLen > 255 )
+    {
+        fwrite( &readLen, 2, 1, bin );           // Read length too long for its byte
+        fwrite( &cycle, 2, 1, bin );             // Current cycles complete
+    }
+    
+    // Lines already written are read back to confirm that a matching hash is an exact duplicate
+    if ( collapseDupes )
+    {
+        fflush( bin );
+        binRead = fns->getReadPointer( fns->bin, false );
+        dupHashes.resize( 65536, 0 );
+        dupLines.resize( 65536, 0 );
     }
 }
 
 BinaryWriter::~BinaryWriter()
 {
-    delete binBuff;
+    delete[] binBuff;
     if ( libCount ) delete[] libCounts;
-    for ( int i ( 0 ); i < 4; i++ )
+}
+
+void BinaryWriter::checkCount( CharId count )
+{
+    // A 32-bit build saves its largest id for a saturated header count
+    if ( count * ( revComp ? 2 : 1 ) >= (CharId)numeric_limits<ReadId>::max() )
     {
-        for ( int j ( 0 ); j < 4; j++ )
-        {
-            delete[] idsBuff[i][j];
-        }
+        cerr << "Error: too many reads for 32-bit read ids. Rebuild with \"make WIDE_IDS=1\" to index more than " << to_string( numeric_limits<ReadId>::max() / ( revComp ? 2 : 1 ) ) << " reads." << endl;
+        exit( EXIT_FAILURE );
     }
 }
 
 void BinaryWriter::close()
 {
     fclose( bin );
+    if ( binRead ) fclose( binRead );
+    binRead = NULL;
+    writeDupes();
     
     // Fill in missing binary variables
     bin = fns->getBinary( true, true );
@@ -413,24 +509,29 @@ void BinaryWriter::close()
     assert( dummy );
     
     fseek( bin, 16, SEEK_SET );
-    fwrite( &seqCount, 4, 1, bin );
+    writeBinaryCount( bin, seqCount, wideBegin );
     fseek( bin, 21, SEEK_SET );
     for ( int i ( 0 ); i < libCount; i++ )
     {
-        fwrite( &libCounts[i], 4, 1, bin );
+        writeBinaryCount( bin, libCounts[i], wideBegin + 8 * ( i + 1 ) );
         fseek( bin, 8, SEEK_CUR );
     }
     fclose( bin );
     
-    // Write counts to trim file
+    // Ids keep to 32 bits unless there are too many reads, and packed ids take only as many bits as the largest id needs
+    uint8_t idBits = seqCount > ( (uint64_t)1 << 32 ) ? 64 : 32;
+    if ( packIds ) for ( idBits = 1; idBits < 64 && ( (uint64_t)1 << idBits ) < seqCount; idBits++ );
+    
+    // Write counts to trim file; the shortest length is kept in one byte, so reads over 255 may list lengths none of them have
     FILE* trm = fns->getWritePointer( fns->tmpTrm );
-    uint8_t minReadLen = readLen;
-    for ( uint8_t i = 0; i < readLen; i++ ) if ( readLens[i] ) minReadLen = min( minReadLen, i );
+    uint16_t minReadLen = min( readLen, uint16_t( 255 ) );
+    for ( uint16_t i = 0; i < minReadLen; i++ ) if ( readLens[i] ) minReadLen = i;
     assert( minReadLen );
-    uint16_t trimBegin = 3 + ( ( readLen-minReadLen ) * 4 );
+    uint16_t trimBegin = 4 + ( ( readLen-minReadLen ) * sizeof( ReadId ) );
     fwrite( &trimBegin, 2, 1, trm );
     fwrite( &minReadLen, 1, 1, trm );
-    for ( uint8_t i = minReadLen; i < readLen; i++ ) fwrite( &readLens[i], 4, 1, trm );
+    fwrite( &idBits, 1, 1, trm );
+    for ( uint16_t i = minReadLen; i < readLen; i++ ) fwrite( &readLens[i], sizeof( ReadId ), 1, trm );
     fclose( trm );
      
     // Set ids bucket limits
@@ -443,19 +544,12 @@ void BinaryWriter::close()
             for ( int k = 1; k < readLen; k++ ) limit = max( limit, charPlaceCounts[3-j][3-i].end()[-k-1] );
             for ( int k : { 0, 1 } )
             {
-                FILE* fp = fns->getWritePointer( fns->tmpIds[k][i][j] );
-                fseek( fp, limit*4, SEEK_SET );
-                fwrite( &limit, 4, 1, fp );
+                FILE* fp = fns->getWritePointer( fns->tmpIds[k][i][j][0] );
+                fseek( fp, ( (CharId)limit * idBits + 7 ) / 8, SEEK_SET );
+                fwrite( &limit, sizeof( ReadId ), 1, fp );
                 fclose( fp );
             }
         }
-        for ( int k : { 0, 1 } )
-        {
-            ReadId dummy = 0;
-            FILE* fp = fns->getWritePointer( fns->tmpIds[k][i][4] );
-            fwrite( &dummy, 4, 1, fp );
-            fclose( fp );
-        }
     }
     
     // Set ins bucket limits
@@ -470,7 +564,7 @@ void BinaryWriter::close()
         }
         for ( int k : { 0, 1 } )
         {
-            FILE* fp = fns->getWritePointer( fns->tmpIns[k][i] );
+            FILE* fp = fns->getWritePointer( fns->tmpIns[k][i][0] );
             fseek( fp, limit*4+8, SEEK_SET );
             fwrite( &limit, 4, 1, fp );
             fclose( fp );
@@ -486,7 +580,7 @@ void BinaryWriter::dumpBin()
 
 void BinaryWriter::dumpIds( uint8_t i, uint8_t j )
 {
-    fwrite( idsBuff[i][j], 4, pIds[i][j], ids[i][j] );
+    fwrite( idsBuff[i][j], sizeof( ReadId ), pIds[i][j], ids[i][j] );
     pIds[i][j] = 0;
 }
 
@@ -501,37 +595,208 @@ void BinaryWriter::setNextLibrary()
     }
     libCounts[currLib] = thisCount;
     currLib++;
+    
+    // Mates this library left single are later collapsed only among themselves
+    singleEnds.push_back( singlesSpilt + singleLines.size() );
+    clearDupes();
 }
 
-void BinaryWriter::write( string &read )
+static uint64_t hashLines( uint8_t* lines, size_t len )
 {
-    // Check and write sequence length into one byte
-    uint8_t line[lineLen];
-    line[0] = read.length();
-    if ( line[0] > readLen )
+    uint64_t hash = len, word;
+    for ( ; len >= 8; lines += 8, len -= 8 )
+    {
+        memcpy( &word, lines, 8 );
+        hash = ( hash ^ word ) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    for ( ; len; lines++, len-- ) hash = ( hash ^ *lines ) * 0x100000001B3ULL;
+    return hash ^ ( hash >> 32 );
+}
+
+void BinaryWriter::clearDupes()
+{
+    // Duplicates are only collapsed within a library
+    fill( dupHashes.begin(), dupHashes.end(), 0 );
+    fill( dupLines.begin(), dupLines.end(), 0 );
+    dupUnits = 0;
+}
+
+void BinaryWriter::collapse( vector<uint8_t> &lines, vector<ReadId> (&placeCounts)[4][4], vector<ReadId> &lens )
+{
+    // Pairs are kept or dropped whole so that mates stay adjacent
+    size_t unitLen = ( currLib < libCount ? 2 : 1 ) * lineLen, kept = 0;
+    bool flushed = false;
+    for ( size_t p = 0; p < lines.size(); p += unitLen )
+    {
+        uint8_t* unit = &lines[p];
+        uint64_t hash = hashLines( unit, unitLen );
+        
+        if ( dupUnits * 2 >= dupHashes.size() )
+        {
+            vector<uint64_t> hashes( dupHashes.size() * 2, 0 );
+            vector<ReadId> firsts( dupLines.size() * 2, 0 );
+            for ( size_t i = 0; i < dupLines.size(); i++ ) if ( dupLines[i] )
+            {
+                size_t h = dupHashes[i] & ( hashes.size() - 1 );
+                while ( firsts[h] ) h = ( h + 1 ) & ( hashes.size() - 1 );
+                hashes[h] = dupHashes[i];
+                firsts[h] = dupLines[i];
+            }
+            dupHashes.swap( hashes );
+            dupLines.swap( firsts );
+        }
+        
+        size_t mask = dupHashes.size() - 1, h = hash & mask;
+        while ( dupLines[h] && ( dupHashes[h] != hash || !sameLines( dupLines[h] - 1, unit, unitLen, lines, flushed ) ) ) h = ( h + 1 ) & mask;
+        
+        if ( dupLines[h] )
+        {
+            for ( size_t i = 0; i < unitLen; i += lineLen ) uncount( unit + i, placeCounts, lens );
+            dupCounts.emplace( dupLines[h] - 1, 1 ).first->second++;
+            dupCount += unitLen / lineLen;
+            continue;
+        }
+        
+        dupHashes[h] = hash;
+        dupLines[h] = seqCount + ( kept / lineLen ) + 1;
+        dupUnits++;
+        if ( kept != p ) memmove( &lines[kept], unit, unitLen );
+        kept += unitLen;
+    }
+    lines.resize( kept );
+}
+
+bool BinaryWriter::sameLines( ReadId line, uint8_t* unit, size_t len, vector<uint8_t> &lines, bool &flushed )
+{
+    // Lines from this batch are still in memory, earlier ones are read back from the binary file
+    if ( line >= seqCount ) return !memcmp( &lines[ (CharId)( line - seqCount ) * lineLen ], unit, len );
+    if ( !flushed ) fflush( bin );
+    flushed = true;
+    uint8_t prior[len];
+    if ( pread( fileno( binRead ), prior, len, seqsBegin + (CharId)line * lineLen ) != (ssize_t)len )
     {
-        read = read.substr( 0, readLen );
-        line[0] = readLen;
-        cerr << "Error: Unexpectedly long read of length " << to_string( line[0] ) << " given set length of " << to_string( readLen ) << "." << endl;
+        cerr << "Error: failed to read back sequence data while collapsing duplicates." << endl;
         exit( EXIT_FAILURE );
     }
-    
-    // Encode characters into 2 bits per byte
-    CharId p = 0;
+    return !memcmp( prior, unit, len );
+}
+
+void BinaryWriter::uncount( uint8_t* line, vector<ReadId> (&placeCounts)[4][4], vector<ReadId> &lens )
+{
+    uint16_t len = lenBytes > 1 ? line[0] | ( line[1] << 8 ) : line[0];
     uint8_t l = 0;
-    for ( uint8_t j ( 0 ); j < line[0]; j++ )
+    for ( uint16_t j ( 0 ); j < len; j++ )
     {
-        uint8_t c = charToInt[ read[j] ];
-        assert( read[j] != 'N' );
-        charPlaceCounts[l][c][j]++;
-        uint8_t i = j & 0x3;
+        uint8_t c = byteToInt[j & 0x3][ line[ lenBytes + j / 4 ] ];
+        placeCounts[l][c][j]--;
         l = c;
-        if ( !i ) line[++p] = intToByte[i][c];
-        else line[p] += intToByte[i][c];
     }
+    lens[len]--;
+}
+
+void BinaryWriter::encode( const char* read, size_t len, uint8_t* line, vector<ReadId> (&placeCounts)[4][4], vector<ReadId> &lens )
+{
+    // Check and write sequence length into one byte, or two for reads longer than 255
+    if ( len > readLen )
+    {
+        cerr << "Error: Unexpectedly long read of length " << to_string( len ) << " given set length of " << to_string( readLen ) << "." << endl;
+        exit( EXIT_FAILURE );
+    }
+    line[0] = len & 0xff;
+    if ( lenBytes > 1 ) line[1] = len >> 8;
+    
+    // Encode characters into 2 bits per byte, then tally each position's dinucleotide from the codes
+    uint8_t codes[readLen];
+    if ( !packBases( read, len, &line[lenBytes], codes ) )
+    {
+        cerr << "Error: Unrecognised character in read to be encoded." << endl;
+        exit( EXIT_FAILURE );
+    }
+    uint8_t l = 0;
+    for ( size_t j ( 0 ); j < len; j++ )
+    {
+        placeCounts[l][ codes[j] ][j]++;
+        l = codes[j];
+    }
+    lens[len]++;
+}
+
+void BinaryWriter::write( string &read )
+{
+    uint8_t line[lineLen];
+    encode( read.data(), read.length(), line, charPlaceCounts, readLens );
+    checkCount( (CharId)seqCount + 1 );
     fwrite( line, 1, lineLen, bin );
     seqCount++;
-    readLens[ line[0] ]++;
+}
+
+void BinaryWriter::write( ReadBatch &batch )
+{
+    // Batches are encoded apart, so only their lines and counts are left to add
+    writeLines( batch.lines, batch.charPlaceCounts, batch.readLens );
+    
+    // Mates left single are held until every single library is written, only going to disk once they outgrow memory
+    if ( singleLines.size() + batch.singleLines.size() > SINGLES_BUFFER )
+    {
+        if ( !singles ) singles = fns->getWritePointer( fns->tmpSingles );
+        fwrite( singleLines.data(), 1, singleLines.size(), singles );
+        singlesSpilt += singleLines.size();
+        singleLines.clear();
+    }
+    singleLines.insert( singleLines.end(), batch.singleLines.begin(), batch.singleLines.end() );
+    for ( int i ( 0 ); i < 4; i++ ) for ( int j ( 0 ); j < 4; j++ ) for ( int k ( 0 ); k < readLen; k++ ) charPlaceCounts[i][j][k] += batch.charPlaceCounts[i][j][k];
+    for ( int k ( 0 ); k <= readLen; k++ ) readLens[k] += batch.readLens[k];
+}
+
+void BinaryWriter::writeLines( vector<uint8_t> &lines, vector<ReadId> (&placeCounts)[4][4], vector<ReadId> &lens )
+{
+    if ( collapseDupes ) collapse( lines, placeCounts, lens );
+    ReadId written = lines.size() / lineLen;
+    checkCount( (CharId)seqCount + written );
+    fwrite( lines.data(), 1, lines.size(), bin );
+    seqCount += written;
+}
+
+ReadId BinaryWriter::writeSingles()
+{
+    // Mates that outlived their pairs were held back already encoded and counted, to follow every single library
+    if ( singles )
+    {
+        fclose( singles );
+        singles = fns->getReadPointer( fns->tmpSingles, false );
+    }
+    
+    // Those spilt to disk come before those still in memory
+    vector<uint8_t> lines;
+    ReadId count = 0;
+    CharId pos = 0;
+    for ( CharId end : singleEnds )
+    {
+        clearDupes();
+        while ( pos < end )
+        {
+            CharId len = min( buffSize, end - pos );
+            if ( pos < singlesSpilt )
+            {
+                len = min( len, singlesSpilt - pos );
+                lines.resize( len );
+                if ( fread( lines.data(), 1, len, singles ) != len )
+                {
+                    cerr << "Error: failed to read back the reads left single by their pairs." << endl;
+                    exit( EXIT_FAILURE );
+                }
+            }
+            else lines.assign( singleLines.begin() + ( pos - singlesSpilt ), singleLines.begin() + ( pos - singlesSpilt + len ) );
+            count += len / lineLen;
+            writeLines( lines, charPlaceCounts, readLens );
+            pos += len;
+        }
+    }
+    if ( singles ) fclose( singles );
+    singles = NULL;
+    vector<uint8_t>().swap( singleLines );
+    return count;
 }
 
 void BinaryWriter::writeBwt()
@@ -547,14 +812,41 @@ void BinaryWriter::writeBwt()
     fwrite( &writeEndBwt, 1, 1, bwt );
     fwrite( &bwtCount, 8, 1, bwt );
     fwrite( &charCounts, 8, 5, bwt );
-    fwrite( &basePos, 4, 4, bwt );
+    fwrite( &basePos, sizeof( ReadId ), 4, bwt );
     fclose( bwt );
 }
 
+void BinaryWriter::writeDupes()
+{
+    // Each line kept for a collapsed read or pair lists how many copies of it were read, in line order
+    if ( !collapseDupes )
+    {
+        fns->removeFile( fns->dup, true );
+        return;
+    }
+    FILE* dup = fns->getWritePointer( fns->dup );
+    uint8_t dupBegin = 10, lineBytes = seqCount > UINT32_MAX ? 8 : 4;
+    fwrite( &dupBegin, 1, 1, dup );
+    fwrite( &id, 8, 1, dup );
+    fwrite( &lineBytes, 1, 1, dup );
+    ReadId pairedLines = 0;
+    for ( int i ( 0 ); i < libCount; i++ ) pairedLines += libCounts[i];
+    if ( revComp ) pairedLines /= 2;
+    for ( pair<const ReadId, uint32_t> &dupe : dupCounts )
+    {
+        for ( uint64_t line = dupe.first; line < dupe.first + ( dupe.first < pairedLines ? 2 : 1 ); line++ )
+        {
+            fwrite( &line, lineBytes, 1, dup );
+            fwrite( &dupe.second, 4, 1, dup );
+        }
+    }
+    fclose( dup );
+}
+
 void BinaryWriter::writeEnd()
 {
     ReadId endcount = 0;
-    fwrite( &endcount, 4, 1, ends );
+    fwrite( &endcount, sizeof( ReadId ), 1, ends );
     fclose( ends );
 }
 
@@ -566,8 +858,8 @@ void BinaryWriter::writeIds()
         {
             dumpIds( i, j );
             fclose( ids[i][j] );
-            ids[i][j] = fns->getReadPointer( fns->tmpIds[0][i][j], true );
-            fwrite( &idsCounts[i][j], 4, 1, ids[i][j] );
+            ids[i][j] = fns->getReadPointer( fns->tmpIds[0][i][j][0], true );
+            fwrite( &idsCounts[i][j], sizeof( ReadId ), 1, ids[i][j] );
             fclose( ids[i][j] );
         }
         fclose( ids[i][4] );
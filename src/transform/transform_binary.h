@@ -26,6 +26,8 @@
 #include "transform_structs.h"
 #include "transform_functions.h"
 #include "transform_bwt.h"
+#include <thread>
+#include <map>
 
 struct BinaryReader
 {
@@ -34,6 +36,8 @@ struct BinaryReader
     
     void finish();
     void init();
+    void load( uint16_t c );
+    void prefetch();
     void prep();
     void read();
     void update();
@@ -45,10 +49,17 @@ struct BinaryReader
     uint8_t* chars,* buff,* ends;
     vector<ReadId> trimCounts;
     
+    // Cycle c is loaded into slot c % 2, so that the next cycle loads while this one is transformed
+    uint8_t* slotChars[2],* slotEnds[2];
+    bool slotAnyEnds[2];
+    uint16_t loaded;
+    thread loader;
+    
     CharId id;
     uint8_t endBitArray[8];
     
-    uint8_t seqsBegin, lineLen, cycle, readLen, revComp, minTrim;
+    uint8_t seqsBegin, lenBytes, revComp, idBits;
+    uint16_t lineLen, cycle, readLen, minTrim;
     uint16_t trmBegin;
     CharId buffSize, fileSize, charSize;
     CharId endCount, prevEndCount;
@@ -58,22 +69,33 @@ struct BinaryReader
 
 struct BinaryWriter
 {
-    BinaryWriter( PreprocessFiles* filenames, uint8_t inLibCount, uint8_t inReadLen, bool revComp );
+    BinaryWriter( PreprocessFiles* filenames, uint8_t inLibCount, uint16_t inReadLen, bool revComp, bool packIds, bool collapseDupes );
     ~BinaryWriter();
     
+    void checkCount( CharId count );
+    void clearDupes();
     void close();
+    void collapse( vector<uint8_t> &lines, vector<ReadId> (&placeCounts)[4][4], vector<ReadId> &lens );
     void dumpBin();
     void dumpIds( uint8_t i, uint8_t j );
+    void encode( const char* read, size_t len, uint8_t* line, vector<ReadId> (&placeCounts)[4][4], vector<ReadId> &lens );
+    bool sameLines( ReadId line, uint8_t* unit, size_t len, vector<uint8_t> &lines, bool &flushed );
     void setNextLibrary();
+    void uncount( uint8_t* line, vector<ReadId> (&placeCounts)[4][4], vector<ReadId> &lens );
     void write( string &read );
+    void write( ReadBatch &batch );
     void writeBwt();
+    void writeDupes();
     void writeEnd();
     void writeIds();
     void writeIns();
+    void writeLines( vector<uint8_t> &lines, vector<ReadId> (&placeCounts)[4][4], vector<ReadId> &lens );
+    ReadId writeSingles();
     
     // File pointers
     PreprocessFiles* fns;
     FILE* bin,* bwt,* ends,* ins[4],* ids[4][5];
+    FILE* binRead,* singles;
     
     // Buffers
     uint8_t* binBuff;
@@ -89,7 +111,21 @@ struct BinaryWriter
     CharId charCounts[5];
     ReadId idsCounts[4][4];
     ReadId seqCount,* libCounts;
-    uint8_t lineLen, readLen, currLib, libCount, seqsBegin, cycle, revComp;
+    uint8_t currLib, libCount, seqsBegin, wideBegin, lenBytes, revComp;
+    uint16_t lineLen, readLen, cycle;
+    bool packIds;
+    
+    // Open addressed table of each distinct line, or pair of lines, in the current library, stored as its first line plus one
+    vector<uint64_t> dupHashes;
+    vector<ReadId> dupLines;
+    map<ReadId, uint32_t> dupCounts;
+    
+    // Mates left single by their pairs, encoded, with where those of each paired library end
+    vector<uint8_t> singleLines;
+    vector<CharId> singleEnds;
+    CharId singlesSpilt;
+    ReadId dupUnits, dupCount;
+    bool collapseDupes;
 };
 
 
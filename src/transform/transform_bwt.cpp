@@ -20,38 +20,26 @@
 
 #include "transform_bwt.h"
 #include "filenames.h"
+#include "scheduler.h"
 #include <cassert>
 #include <string.h>
 #include <iostream>
 //#include <chrono>
 //#include <iomanip>
 
-BwtCycler::BwtCycler( PreprocessFiles* filenames )
-: fns( filenames )
+BwtCycler::BwtCycler( PreprocessFiles* filenames, uint8_t bucket, uint8_t idBits, bool asyncIo )
+: fns( filenames ), bucket( bucket ), idBits( idBits ), endBits( idBits > 32 ? 64 : 32 )
 {
-    // Create buffers
-    inBwtBuff = new uint8_t[BWT_BUFFER];
-    outBwtBuff = new uint8_t[BWT_BUFFER];
-    inInsBuff = new uint8_t[BWT_BUFFER];
-    inEndBuff = new ReadId[IDS_BUFFER];
-    outEndBuff = new ReadId[IDS_BUFFER];
-    for ( int i ( 0 ); i < 4; i++ )
-    {
-        inIdsBuff[i] = new ReadId[IDS_BUFFER];
-        outInsBuff[i] = new uint8_t[BWT_BUFFER];
-        for ( int j ( 0 ); j < 5; j++ )
-        {
-            outIdsBuff[i][j] = new ReadId[IDS_BUFFER];
-        }
-    }
-    inIdsBuff[4] = new ReadId[IDS_BUFFER];
+    // Each cycler runs on one thread at a time, so it keeps a ring of its own
+    io = asyncIo && ring.init( 256 ) ? &ring : NULL;
     
     samePosFlag = (CharId)1 << 63;
     samePosMask = ~samePosFlag;
     sameByteFlag = (uint8_t)1 << 7;
     sameByteMask = ~sameByteFlag;
     
-    isFinal = isPenultimate = false;
+    isFinal = isPenultimate = holdFirst = false;
+    sized = false;
     
     FILE* bin = fns->getBinary( true, false );
     readEndBwt = writeEndBwt = readEndIds = writeEndIds = false;
@@ -90,54 +78,106 @@ BwtCycler::BwtCycler( PreprocessFiles* filenames )
 
 BwtCycler::~BwtCycler()
 {
-    if ( inBwtBuff ) delete[] inBwtBuff;
-    if ( outBwtBuff ) delete[] outBwtBuff;
-    if ( inInsBuff ) delete[] inInsBuff;
-    if ( inEndBuff ) delete[] inEndBuff;
-    if ( outEndBuff ) delete[] outEndBuff;
-    for ( int i ( 0 ); i < 4; i++ )
+}
+
+void BwtCycler::append( BwtCycler* seg )
+{
+    // Segments are copied in directly, after which the output streams are reopened to carry on from their new ends
+    vector<uint8_t> copy( BWT_BUFFER );
+    
+    // The segment's first and last runs were held back so that they can merge with their neighbours
+    if ( !seg->bwtFirst && seg->holdFirst )
     {
-        if ( inIdsBuff[i] ) delete[] inIdsBuff[i];
-        if ( outInsBuff[i] ) delete[] outInsBuff[i];
-        for ( int j ( 0 ); j < 5; j++ )
+        appendRun( seg->lastChar, seg->lastRun );
+    }
+    else if ( !seg->bwtFirst )
+    {
+        appendRun( seg->firstChar, seg->firstRun );
+        writeLast();
+        bwtOut.flush();
+        for ( size_t n; ( n = fread( copy.data(), 1, copy.size(), seg->outBwt ) ); )
         {
-            if ( outIdsBuff[i][j] ) delete[] outIdsBuff[i][j];
+            fwrite( copy.data(), 1, n, outBwt );
+            bwtCount += n;
         }
+        bwtOut.open( outBwt, io );
+        lastChar = seg->lastChar;
+        lastRun = seg->lastRun;
+    }
+    
+    endOut.flush();
+    for ( size_t n; ( n = fread( copy.data(), 1, copy.size(), seg->outEnd ) ); )
+    {
+        fwrite( copy.data(), 1, n, outEnd );
     }
-    if ( inIdsBuff[4] ) delete[] inIdsBuff[4];
+    endOut.open( outEnd, endBits, io );
+    
+    for ( int i ( 0 ); i < 5; i++ )
+    {
+        charCounts[i] += seg->charCounts[i];
+    }
+    fclose( seg->outBwt );
+    fclose( seg->outEnd );
 }
 
-void BwtCycler::finish( uint8_t cycle )
+void BwtCycler::appendRun( uint8_t c, ReadId runLen )
 {
-    fns->setCyclerFinal( inBwt, outBwt, inEnd, outEnd, cycle );
-    prepIn();
-    prepOutFinal();
+    // Run lengths are held as one less than their true length
+    if ( c == lastChar )
+    {
+        lastRun += runLen + 1;
+    }
+    else
+    {
+        writeLast();
+        lastChar = c;
+        lastRun = runLen;
+    }
+}
+
+void BwtCycler::finish( BwtCycler* (&cyclers)[4], uint16_t cycle, int threadCount )
+{
+    setSizes( cyclers, cycle );
+    WorkScheduler::run( 4, threadCount, [&]( size_t i ){
+        cyclers[i]->finishBucket( cycle );
+    } );
     
-    for ( int i ( 0 ); i < 4; i++ )
+    // Later buckets were written to their own segments, which are appended to the first in order
+    for ( int i ( 1 ); i < 4; i++ )
     {
-        fns->setCyclerFinalIter( inIns, inIds[4], cycle, i );
-        prepIter();
-        finishIter( i );
+        cyclers[0]->append( cyclers[i] );
     }
+    cyclers[0]->flushFinal();
+}
+
+void BwtCycler::finishBucket( uint16_t cycle )
+{
+    fns->setCyclerFinal( inBwt, outBwt, inEnd, outEnd, cycle, bucket );
+    prepIn( cycle );
+    prepOutFinal();
     
-    // Flush buffers and close write files
-    writeLast();
+    for ( uint8_t s ( 0 ); s < 4; s++ )
+    {
+        fns->setCyclerFinalIter( inIns, inIds[4], cycle, bucket, s );
+        prepIter( s );
+        finishIter();
+    }
+    writeTail();
     fclose( inBwt );
-    fwrite( outBwtBuff, 1, pOutBwt, outBwt );
+    fclose( inEnd );
+    
+    // The first bucket keeps its last run pending and its files open for the others to be appended
+    if ( !bucket ) return;
+    bwtOut.flush();
     fclose( outBwt );
-    fwrite( outEndBuff, 4, pOutEnd, outEnd );
+    endOut.flush();
     fclose( outEnd );
-    outBwt = fns->getReadPointer( fns->bwt, true );
-    uint8_t bwtBegin = 57;
-    fwrite( &bwtBegin, 1, 1, outBwt );
-    fwrite( &id, 8, 1, outBwt );
-    fwrite( &bwtCount, 8, 1, outBwt );
-    fwrite( &charCounts[4], 8, 1, outBwt );
-    fwrite( &charCounts, 8, 4, outBwt );
-    fclose( outBwt );
+    
+    // The rest reopen their segments to be read back by the first
+    fns->setCyclerMerge( outBwt, outEnd, cycle, bucket );
 }
-//
-void BwtCycler::finishIter( uint8_t i )
+
+void BwtCycler::finishIter()
 {
     if ( insLeft ) readNextPos();
     
@@ -154,71 +194,72 @@ void BwtCycler::finishIter( uint8_t i )
         }
     }
     
-    nextPos = -1;
-    if ( currSplit )
-    {
-        writeRun( splitChar, splitRun );
-        currSplit = false;
-        if ( splitChar == 4 ) rewriteEnd( splitRun );
-    }
-    
-    while ( currPos < charSizes[i] )
-    {
-        writeBwt();
-    }
-    assert( currPos >= charSizes[i] );
-    currPos -= charSizes[i];
-    
     fclose( inIns );
     fclose( inIds[4] );
 }
 
-void BwtCycler::flush( uint8_t cycle )
+void BwtCycler::flush()
 {
-    // Flush buffers and close write files
+    // Flush buffers
     writeLast();
-    fwrite( outBwtBuff, 1, pOutBwt, outBwt );
-    fclose( outBwt );
-    fwrite( outEndBuff, 4, pOutEnd, outEnd );
-    fclose( outEnd );
-    
+    bwtOut.flush();
+    endOut.flush();
     for ( int i ( 0 ); i < 4; i++ )
     {
-        writeInsBuff( i );
-        fclose( outIns[i] );
+        insOut[i].flush();
         for ( int j ( 0 ); j < 5; j++ )
         {
-            fwrite( outIdsBuff[i][j], 4, pOutIds[i][j], outIds[i][j] );
-            fclose( outIds[i][j] );
+            idsOut[i][j].flush();
         }
     }
     
-    // Edit in counts
-    fns->setCyclerUpdate( outBwt, outEnd, outIns, outIds, cycle );
+    // Edit in counts and close write files
     fseek( outBwt, 9, SEEK_SET );
     fwrite( &bwtCount, 8, 1, outBwt );
-    fwrite( &charCounts, 8, 4, outBwt );
+    fwrite( &charCounts, 8, 5, outBwt );
     fclose( outBwt );
-    fwrite ( &endCount, 4, 1, outEnd );
+    fseek( outEnd, 0, SEEK_SET );
+    fwrite( &endOut.count, sizeof( ReadId ), 1, outEnd );
     fclose( outEnd );
     
     for ( int i ( 0 ); i < 4; i++ )
     {
-        fwrite( &insCounts[i], 8, 1, outIns[i] );
+        fseek( outIns[i], 0, SEEK_SET );
+        fwrite( &insOut[i].count, 8, 1, outIns[i] );
         fclose( outIns[i] );
         for ( int j ( 0 ); j < 5; j++ )
         {
-            fwrite( &idsCounts[i][j], 4, 1, outIds[i][j] );
+            fseek( outIds[i][j], 0, SEEK_SET );
+            fwrite( &idsOut[i][j].count, sizeof( ReadId ), 1, outIds[i][j] );
             fclose( outIds[i][j] );
         }
     }
 }
 
-void BwtCycler::prepIn()
+void BwtCycler::flushFinal()
+{
+    // Flush buffers and close write files
+    writeLast();
+    bwtOut.flush();
+    fclose( outBwt );
+    endOut.flush();
+    fclose( outEnd );
+    outBwt = fns->getReadPointer( fns->bwt, true );
+    uint8_t bwtBegin = 57;
+    fwrite( &bwtBegin, 1, 1, outBwt );
+    fwrite( &id, 8, 1, outBwt );
+    fwrite( &bwtCount, 8, 1, outBwt );
+    fwrite( &charCounts[4], 8, 1, outBwt );
+    fwrite( &charCounts, 8, 4, outBwt );
+    fclose( outBwt );
+}
+
+void BwtCycler::prepIn( uint16_t cycle )
 {
     // Read sizes for this cycle
     bool doReadBwtEnds;
-    CharId thisId;
+    CharId thisId, segCounts[5];
+    ReadId endLeft;
     fread( &thisId, 8, 1, inBwt );
     if ( thisId != id )
     {
@@ -227,44 +268,44 @@ void BwtCycler::prepIn()
     }
     fread( &doReadBwtEnds, 1, 1, inBwt );
     fread( &bwtLeft, 8, 1, inBwt );
-    fread( &charSizes, 8, 5, inBwt );
-    fread( &basePos, 4, 4, inBwt );
-    fread( &endLeft, 4, 1, inEnd );
+    fread( &segCounts, 8, 5, inBwt );
+    fread( &basePos, sizeof( ReadId ), 4, inBwt );
+    fread( &endLeft, sizeof( ReadId ), 1, inEnd );
     if ( doReadBwtEnds )
     {
         if ( !readEndBwt ) setReadEnds();
         if ( !writeEndBwt ) setWriteEnds();
     }
     
-    // Reset pointers and counts for cycle
+    // Reset streams and counts for cycle
+    bwtIn.open( inBwt, bwtLeft, io );
+    endIn.open( inEnd, endLeft, endBits, io );
     bwtFirst = true;
     currSplit = false;
     lastChar = -1;
     bwtCount = currPos = 0;
-    pInBwt = BWT_BUFFER;
-    pInEnd = IDS_BUFFER;
-    pOutBwt = pOutEnd = 0;
     for ( int i ( 0 ); i < 4; i++ )
     {
-        charCounts[i] = basePos[i];
+        charCounts[i] = bucket ? 0 : basePos[i];
     }
     charCounts[4] = 0;
-    memset( lastIns, 0, 32 );
-    memset( inSapCount, 0, 20 );
-    memset( outSapCount, 0, 20 );
+    memset( lastIns, 0, sizeof( lastIns ) );
+    memset( inSapCount, 0, sizeof( inSapCount ) );
+    memset( outSapCount, 0, sizeof( outSapCount ) );
 }
 
-void BwtCycler::prepIter()
+void BwtCycler::prepIter( uint8_t seg )
 {
     fread( &insLeft, 8, 1, inIns );
-    pInIns = BWT_BUFFER;
-    nextPos = insLeft ? 0 : -1;
+    insIn.open( inIns, insLeft, io );
+    nextPos = insBases[seg];
     
     for ( int j ( 0 ); j < 5; j++ )
     {
         if ( isFinal && j < 4 ) continue;
-        fread( &idsLeft[j], 4, 1, inIds[j] );
-        pInIds[j] = IDS_BUFFER;
+        ReadId idsLeft;
+        fread( &idsLeft, sizeof( ReadId ), 1, inIds[j] );
+        idsIn[j].open( inIds[j], idsLeft, idBits, io );
     }
 }
 
@@ -282,19 +323,18 @@ void BwtCycler::prepOut()
         writeEndIds = true;
         if ( !writeEndBwt ) setWriteEnds();
     }
-    endCount = 0;
     
     for ( int i ( 0 ); i < 4; i++ )
     {
-        insCounts[i] = 0;
-        pOutIns[i] = 0;
-        fwrite( &insCounts[i], 8, 1, outIns[i] );
+        CharId insCount = 0;
+        ReadId idsCount = 0;
+        fwrite( &insCount, 8, 1, outIns[i] );
+        insOut[i].open( outIns[i], io );
         
         for ( int j ( 0 ); j < 5; j++ )
         {
-            idsCounts[i][j] = 0;
-            pOutIds[i][j] = 0;
-            fwrite( &idsCounts[i][j], 4, 1, outIds[i][j] );
+            fwrite( &idsCount, sizeof( ReadId ), 1, outIds[i][j] );
+            idsOut[i][j].open( outIds[i][j], idBits, io );
         }
     }
     
@@ -303,8 +343,11 @@ void BwtCycler::prepOut()
     fwrite( &writeEndBwt, 1, 1, outBwt );
     fwrite( &bwtCount, 8, 1, outBwt );
     fwrite( &charCounts, 8, 5, outBwt );
-    fwrite( &basePos, 4, 4, outBwt );
-    fwrite( &endCount, 4, 1, outEnd );
+    fwrite( &basePos, sizeof( ReadId ), 4, outBwt );
+    ReadId endCount = 0;
+    fwrite( &endCount, sizeof( ReadId ), 1, outEnd );
+    bwtOut.open( outBwt, io );
+    endOut.open( outEnd, endBits, io );
 }
 
 void BwtCycler::prepOutFinal()
@@ -312,8 +355,19 @@ void BwtCycler::prepOutFinal()
     isFinal = true;
     if ( !writeEndBwt ) setWriteEnds();
     
-    endCount = 0;
-    uint8_t bwtBegin = 57, idsBegin = 9;
+    memset( &charCounts, 0, 40 );
+    
+    // Later buckets write bare segments, holding back their first run to be merged when appended
+    if ( bucket )
+    {
+        holdFirst = true;
+        bwtOut.open( outBwt, io );
+        endOut.open( outEnd, endBits, io );
+        return;
+    }
+    
+    // Ids wider than 32 bits are flagged by a width byte after the session id
+    uint8_t bwtBegin = 57, idsBegin = endBits > 32 ? 10 : 9, idBytes = endBits / 8;
     CharId finalEndCount = basePos[0] + basePos[1] + basePos[2] + basePos[3];
     fwrite( &bwtBegin, 1, 1, outBwt );
     fwrite( &id, 8, 1, outBwt );
@@ -323,8 +377,10 @@ void BwtCycler::prepOutFinal()
     
     fwrite( &idsBegin, 1, 1, outEnd );
     fwrite( &id, 8, 1, outEnd );
+    if ( idsBegin > 9 ) fwrite( &idBytes, 1, 1, outEnd );
+    bwtOut.open( outBwt, io );
+    endOut.open( outEnd, endBits, io );
     
-    memset( &charCounts, 0, 40 );
     for ( int i ( 0 ); i < 4; i++ )
     {
         if ( basePos[i] )
@@ -335,38 +391,14 @@ void BwtCycler::prepOutFinal()
     currPos = 0;
 }
 
-void BwtCycler::readBwtIn()
-{
-    fread( inBwtBuff, 1, min( BWT_BUFFER, bwtLeft), inBwt );
-    pInBwt = 0;
-}
-
-void BwtCycler::readInsertBuff()
-{
-    if ( pInIns < BWT_BUFFER )
-    {
-        CharId diff = BWT_BUFFER - pInIns;
-        memcpy( inInsBuff, &inInsBuff[pInIns], diff );
-        fread( &inInsBuff[diff], 1, min( insLeft - 1, BWT_BUFFER ) - diff, inIns );
-    }
-    else
-    {
-        fread( inInsBuff, 1, min( insLeft - 1, BWT_BUFFER ), inIns );
-    }
-    pInIns = 0;
-}
-
 void BwtCycler::readNextId()
 {
     // Refresh IDs buffer if necessary
-    if ( pInIds[thisChar] == IDS_BUFFER )
-    {
-        fread( inIdsBuff[thisChar], 4, min( idsLeft[thisChar], IDS_BUFFER ), inIds[thisChar] );
-        pInIds[thisChar] = 0;
-    }
+    IdReader &in = idsIn[thisChar];
+    if ( in.p == in.n ) in.refill();
 
     // Set id and next character
-    nextId = inIdsBuff[thisChar][ pInIds[thisChar]++ ];
+    nextId = in.buff[ in.p++ ];
     if ( anyEnds && ( ends[ (nextId / 2) / 8 ] & endBitArray[ (nextId / 2) % 8 ] ) )
     {
         nextChar = 4;
@@ -375,29 +407,19 @@ void BwtCycler::readNextId()
     {
         nextChar = byteToInt[ nextId & 0x3 ][ chars[ nextId / 4 ] ];
     }
-    --idsLeft[thisChar];
 }
 
 void BwtCycler::readNextPos()
 {
-    // Refresh inserts buffer if necessary
-    if ( pInIns == BWT_BUFFER )
-    {
-        fread( inInsBuff, 1, min( insLeft, BWT_BUFFER ), inIns );
-        pInIns = 0;
-    }
-    
-    thisChar = inInsBuff[pInIns++];
+    thisChar = insIn.get();
     nextSame = thisChar & uint8_t(128);
     uint8_t posBytes = ( thisChar >> 3 ) & 0x7;
-    if ( pInIns == BWT_BUFFER ) readInsertBuff();
     --insLeft;
-    CharId thisPos = inInsBuff[pInIns++];
+    CharId thisPos = insIn.get();
     while ( posBytes-- )
     {
-        if ( pInIns == BWT_BUFFER ) readInsertBuff();
         --insLeft;
-        thisPos = ( thisPos << 8 ) ^ inInsBuff[pInIns++];
+        thisPos = ( thisPos << 8 ) ^ insIn.get();
     }
     nextPos += thisPos;
     
@@ -425,56 +447,45 @@ void BwtCycler::readNextPos()
     }
 }
 
-void BwtCycler::run( uint8_t* inChars, uint8_t* inEnds, uint8_t cycle )
+void BwtCycler::run( BwtCycler* (&cyclers)[4], uint8_t* inChars, uint8_t* inEnds, uint16_t cycle, int threadCount )
+{
+    setSizes( cyclers, cycle );
+    WorkScheduler::run( 4, threadCount, [&]( size_t i ){
+        cyclers[i]->runBucket( inChars, inEnds, cycle );
+    } );
+}
+
+void BwtCycler::runBucket( uint8_t* inChars, uint8_t* inEnds, uint16_t cycle )
 {
-    fns->setCycler( inBwt, outBwt, inEnd, outEnd, outIns, outIds, cycle );
+    fns->setCycler( inBwt, outBwt, inEnd, outEnd, outIns, outIds, cycle, bucket );
     chars = inChars;
     ends = inEnds;
     
-    double cycleStart = clock();
-//    auto t_start = std::chrono::high_resolution_clock::now();
-
-    prepIn();
+    prepIn( cycle );
     prepOut();
     
-    
-    for ( int i ( 0 ); i < 4; i++ )
+    // Inserts into this bucket arrive in one segment from each bucket of the previous cycle
+    for ( uint8_t s ( 0 ); s < 4; s++ )
     {
-        fns->setCyclerIter( inIns, inIds, cycle, i );
-        prepIter();
-        runIter( i );
+        fns->setCyclerIter( inIns, inIds, cycle, bucket, s );
+        prepIter( s );
+        runIter();
     }
+    writeTail();
     
     assert( !bwtLeft );
-    flush( cycle );
+    flush();
     fclose( inBwt );
     fclose( inEnd );
-    
-//    cout << std::fixed << std::setprecision(2) << " cycle: " << ( clock() - cycleStart ) / CLOCKS_PER_SEC << " vs " << ( ( std::chrono::high_resolution_clock::now() - t_start ).count() / 1000.0 ) / CLOCKS_PER_SEC << " ... " << std::flush;
 }
 
 void BwtCycler::rewriteEnd( ReadId runLen )
 {
     assert( runLen );
-    while ( runLen-- )
-    {
-        if ( pInEnd == IDS_BUFFER )
-        {
-            fread( inEndBuff, 4, min( endLeft, IDS_BUFFER ), inEnd );
-            pInEnd = 0;
-        }
-        if ( pOutEnd == IDS_BUFFER )
-        {
-            fwrite( outEndBuff, 4, IDS_BUFFER, outEnd );
-            pOutEnd = 0;
-        }
-        outEndBuff[ pOutEnd++ ] = inEndBuff[ pInEnd++ ];
-        ++endCount;
-        --endLeft;
-    }
+    while ( runLen-- ) endOut.put( endIn.get() );
 }
 
-void BwtCycler::runIter( uint8_t i )
+void BwtCycler::runIter()
 {
     if ( insLeft ) readNextPos();
     
@@ -499,25 +510,43 @@ void BwtCycler::runIter( uint8_t i )
         }
     }
     
-    nextPos = -1;
-    if ( currSplit )
+    fclose( inIns );
+    for ( int j ( 0 ); j < 5; j++ )
     {
-        writeRun( splitChar, splitRun );
-        currSplit = false;
-        if ( splitChar == 4 ) rewriteEnd( splitRun );
+        fclose( inIds[j] );
     }
-    
-    while ( currPos < charSizes[i] )
+}
+
+void BwtCycler::setSizes( BwtCycler* (&cyclers)[4], uint16_t cycle )
+{
+    // Each segment's character counts are those its cycler wrote last cycle, and are only read from the segments' headers on the first cycle run
+    CharId segCounts[4][5];
+    if ( cyclers[0]->sized )
     {
-        writeBwt();
+        for ( int s ( 0 ); s < 4; s++ ) memcpy( segCounts[s], cyclers[s]->charCounts, sizeof( segCounts[s] ) );
+    }
+    else
+    {
+        FILE* inBwts[4];
+        cyclers[0]->fns->setCyclerSizes( inBwts, cycle );
+        for ( int s ( 0 ); s < 4; s++ )
+        {
+            fseek( inBwts[s], 17, SEEK_SET );
+            fread( &segCounts[s], 8, 5, inBwts[s] );
+            fclose( inBwts[s] );
+        }
     }
-    assert( currPos >= charSizes[i] );
-    currPos -= charSizes[i];
     
-    fclose( inIns );
-    for ( int j ( 0 ); j < 4; j++ )
+    // A bucket's size is the count of its character across every segment, each of which positions its inserts from where the previous left off
+    for ( int i ( 0 ); i < 4; i++ )
     {
-        fclose( inIds[j] );
+        cyclers[i]->bucketSize = 0;
+        for ( int s ( 0 ); s < 4; s++ )
+        {
+            cyclers[i]->insBases[s] = cyclers[i]->bucketSize;
+            cyclers[i]->bucketSize += segCounts[s][i];
+        }
+        cyclers[i]->sized = true;
     }
 }
 
@@ -559,31 +588,22 @@ void BwtCycler::setWriteEnds()
     writeEndBwt = true;
 }
 
-void BwtCycler::writeIdsToFile( uint8_t i, uint8_t j )
-{
-    fwrite( outIdsBuff[i][j], 4, pOutIds[i][j], outIds[i][j] );
-    pOutIds[i][j] = 0;
-}
-
 void BwtCycler::writeBwt()
 {
-    if ( pInBwt == BWT_BUFFER ) readBwtIn();
-    uint8_t currChar = inBwtBuff[pInBwt];
+    uint8_t currChar = bwtIn.get();
     uint8_t c = readArray[ currChar ];
     ReadId runLen = runLenArray[ currChar ];
     --bwtLeft;
-    ++pInBwt;
     
     // Count run length if greater than 63
     if ( isRunArray[currChar] )
     {
-        if ( pInBwt == BWT_BUFFER ) readBwtIn();
         ReadId thisRun = 0;
-        uint8_t shiftCount = 0;
+        uint8_t shiftCount = 0, runByte;
         do {
-            if ( pInBwt == BWT_BUFFER ) readBwtIn();
-            thisRun ^= ( inBwtBuff[pInBwt] & sameByteMask ) << ( shiftCount++ * 7 );
-        } while ( inBwtBuff[pInBwt++] & sameByteFlag );
+            runByte = bwtIn.get();
+            thisRun ^= ( runByte & sameByteMask ) << ( shiftCount++ * 7 );
+        } while ( runByte & sameByteFlag );
         
         runLen += thisRun;
         bwtLeft -= shiftCount;
@@ -603,13 +623,7 @@ void BwtCycler::writeBwt()
 
 void BwtCycler::writeBwtByte( uint8_t c )
 {
-    if ( pOutBwt == BWT_BUFFER )
-    {
-        fwrite( outBwtBuff, 1, BWT_BUFFER, outBwt );
-        pOutBwt = 0;
-    }
-    
-    outBwtBuff[ pOutBwt++ ] = c;
+    bwtOut.put( c );
     ++bwtCount;
 }
 
@@ -619,14 +633,12 @@ void BwtCycler::writeEnd()
 //    bool isDupe = nextSame;
     if ( nextSame )
     {
-        if ( pInIns == BWT_BUFFER ) readInsertBuff();
         --insLeft;
-        thisSap = inInsBuff[pInIns++];
+        thisSap = insIn.get();
         for ( uint8_t j = thisChar & 0x3; j--; )
         {
-            if ( pInIns == BWT_BUFFER ) readInsertBuff();
             --insLeft;
-            thisSap = ( thisSap << 8 ) ^ inInsBuff[pInIns++];
+            thisSap = ( thisSap << 8 ) ^ insIn.get();
         }
     }
     
@@ -641,19 +653,8 @@ void BwtCycler::writeEnd()
     
     while ( thisSap-- )
     {
-        if ( pInIds[4] == IDS_BUFFER )
-        {
-            fread( inIdsBuff[4], 4, min( IDS_BUFFER, idsLeft[4] ), inIds[4] );
-            pInIds[4] = 0;
-        }
-        if ( pOutEnd == IDS_BUFFER )
-        {
-            fwrite( outEndBuff, 4, IDS_BUFFER, outEnd );
-            pOutEnd = 0;
-        }
-        
-//        dupeArray[dupeCount++] = inIdsBuff[4][ pInIds[4] ];
-        outEndBuff[ pOutEnd++ ] = inIdsBuff[4][ pInIds[4]++ ];
+//        dupeArray[dupeCount++] = idsIn[4].buff[ idsIn[4].p ];
+        endOut.put( idsIn[4].get() );
     }
     
 //    if ( isDupe )
@@ -662,18 +663,13 @@ void BwtCycler::writeEnd()
 //    }
 }
 
-void BwtCycler::writeInsBuff( uint8_t i )
-{
-    fwrite( outInsBuff[i], 1, pOutIns[i], outIns[i] );
-    insCounts[i] += pOutIns[i];
-    pOutIns[i] = 0;
-}
-
 void BwtCycler::writeInsBytes()
 {
     CharId ins = charCounts[thisChar] - lastIns[thisChar];
     lastIns[thisChar] = charCounts[thisChar];
+    ByteWriter &out = insOut[thisChar];
     
+    // The insert's leading byte was just put, and still sits in the buffer to take the width of its position
     uint8_t posBytes = ins > 255;
     if ( posBytes )
     {
@@ -684,17 +680,12 @@ void BwtCycler::writeInsBytes()
             insRemain >>= 8;
         }
         
-        outInsBuff[thisChar][ pOutIns[thisChar]++ ] ^= ( posBytes << 3 );
-        for ( int i = posBytes + 1; i--; )
-        {
-            if ( pOutIns[thisChar] == BWT_BUFFER ) writeInsBuff( thisChar );
-            outInsBuff[thisChar][ pOutIns[thisChar]++ ] = ins >> ( 8 * i );
-        }
+        out.buff[ out.p - 1 ] ^= ( posBytes << 3 );
+        for ( int i = posBytes + 1; i--; ) out.put( ins >> ( 8 * i ) );
     }
     else
     {
-        if ( ++pOutIns[thisChar] == BWT_BUFFER ) writeInsBuff( thisChar );
-        outInsBuff[thisChar][ pOutIns[thisChar]++ ] = ins;
+        out.put( ins );
     }
 }
 
@@ -705,6 +696,13 @@ void BwtCycler::writeLast()
         bwtFirst = false;
         return;
     }
+    if ( holdFirst )
+    {
+        holdFirst = false;
+        firstChar = lastChar;
+        firstRun = lastRun;
+        return;
+    }
     
     uint8_t maxBase = writeMaxBase[lastChar];
     if ( lastRun < maxBase )
@@ -729,9 +727,7 @@ void BwtCycler::writeNext()
 {
     if ( thisChar != 4 )
     {
-        // Write Insert buffer to file if full
-        if ( pOutIns[thisChar] == BWT_BUFFER ) writeInsBuff( thisChar );
-        outInsBuff[thisChar][ pOutIns[thisChar] ] = nextChar;
+        insOut[thisChar].put( nextChar );
         writeInsBytes();
     }
     
@@ -742,30 +738,8 @@ void BwtCycler::writeNext()
 
 void BwtCycler::writeNextId()
 {
-    if ( thisChar == 4 )
-    {
-        if ( pOutEnd == IDS_BUFFER )
-        {
-            fwrite( outEndBuff, 4, IDS_BUFFER, outEnd );
-            pOutEnd = 0;
-        }
-        
-        outEndBuff[ pOutEnd++ ] = nextId;
-        ++endCount;
-    }
-    else
-    {
-        // Write IDs buffer to file if full
-        if ( pOutIds[thisChar][nextChar] == IDS_BUFFER )
-        {
-            fwrite( outIdsBuff[thisChar][nextChar], 4, IDS_BUFFER, outIds[thisChar][nextChar] );
-            pOutIds[thisChar][nextChar] = 0;
-        }
-
-        // Write id to buffer
-        outIdsBuff[thisChar][nextChar][ pOutIds[thisChar][nextChar]++ ] = nextId;
-        idsCounts[thisChar][nextChar]++;
-    }
+    if ( thisChar == 4 ) endOut.put( nextId );
+    else idsOut[thisChar][nextChar].put( nextId );
 }
 
 void BwtCycler::writeRun( uint8_t c, ReadId runLen )
@@ -790,13 +764,12 @@ void BwtCycler::writeSame()
     uint8_t baseBytes = ( thisChar & 0x3 );
     if ( thisChar & 0x4 )
     {
-        if ( pInIns + 1 + baseBytes > BWT_BUFFER ) readInsertBuff();
         insLeft -= 1 + baseBytes;
         thisChar = 4;
-        ReadId thisSap = inInsBuff[pInIns++];
+        ReadId thisSap = insIn.get();
         for ( uint8_t j = baseBytes; j--; )
         {
-            thisSap = ( thisSap << 8 ) ^ inInsBuff[pInIns++];
+            thisSap = ( thisSap << 8 ) ^ insIn.get();
         }
         writeRun( thisChar, thisSap );
         while ( thisSap-- )
@@ -806,21 +779,20 @@ void BwtCycler::writeSame()
         }
     }
     
-    if ( pInIns + ( 1 + baseBytes ) * 4 > BWT_BUFFER ) readInsertBuff();
     insLeft -= ( 1 + baseBytes ) * 4;
     for ( int i = 0; i < 4; i++ )
     {
         thisChar = i;
-        ReadId thisSap = inInsBuff[pInIns++];
+        ReadId thisSap = insIn.get();
         for ( uint8_t j = baseBytes; j--; )
         {
-            thisSap = ( thisSap << 8 ) ^ inInsBuff[pInIns++];
+            thisSap = ( thisSap << 8 ) ^ insIn.get();
         }
         
         if ( thisSap > 1 )
         {
             // Write IDs and count same runs
-            memset( &outSapCount, 0, 20 );
+            memset( &outSapCount, 0, sizeof( outSapCount ) );
             for ( ReadId j = 0; j < thisSap; j++ )
             {
                 readNextId();
@@ -830,8 +802,7 @@ void BwtCycler::writeSame()
             ReadId maxCount = max( outSapCount[0], max( outSapCount[1], max( outSapCount[2], max( outSapCount[3], outSapCount[4] ) ) ) );
             uint8_t thisBytes = maxCount < sapMax1 ? 0 : ( maxCount < sapMax2 ? 1 : ( maxCount < sapMax3 ? 2 : 3 ) );
             
-            if ( pOutIns[i] == BWT_BUFFER ) writeInsBuff( i );
-            outInsBuff[i][ pOutIns[i] ] = 128 ^ ( outSapCount[4] ? 4 : 0 ) ^ thisBytes;
+            insOut[i].put( 128 ^ ( outSapCount[4] ? 4 : 0 ) ^ thisBytes );
             writeInsBytes();
             writeRun( thisChar, thisSap );
             
@@ -840,8 +811,7 @@ void BwtCycler::writeSame()
             {
                 for ( uint8_t j = thisBytes + 1; j--; )
                 {
-                    if ( pOutIns[i] == BWT_BUFFER ) writeInsBuff( i );
-                    outInsBuff[i][ pOutIns[i]++ ] = outSapCount[4] >> ( 8 * j );
+                    insOut[i].put( outSapCount[4] >> ( 8 * j ) );
                 }
             }
             
@@ -852,8 +822,7 @@ void BwtCycler::writeSame()
                 {
                     for ( uint8_t k = thisBytes + 1; k--; )
                     {
-                        if ( pOutIns[i] == BWT_BUFFER ) writeInsBuff( i );
-                        outInsBuff[i][ pOutIns[i]++ ] = outSapCount[j] >> ( 8 * k );
+                        insOut[i].put( outSapCount[j] >> ( 8 * k ) );
                     }
                 }
             }
@@ -865,3 +834,21 @@ void BwtCycler::writeSame()
         }
     }
 }
+
+void BwtCycler::writeTail()
+{
+    // Copy out the remainder of this bucket's BWT after its last insert
+    nextPos = -1;
+    if ( currSplit )
+    {
+        writeRun( splitChar, splitRun );
+        currSplit = false;
+        if ( splitChar == 4 ) rewriteEnd( splitRun );
+    }
+    
+    while ( currPos < bucketSize )
+    {
+        writeBwt();
+    }
+    assert( currPos == bucketSize );
+}
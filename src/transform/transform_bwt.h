@@ -25,38 +25,42 @@
 #include "filenames.h"
 #include "transform_constants.h"
 #include "transform_functions.h"
+#include "transform_streams.h"
 
+// Each cycler transforms one bucket; the four buckets of a cycle are independent of one another
 struct BwtCycler
 {
 public:
-    BwtCycler( PreprocessFiles* filenames );
+    BwtCycler( PreprocessFiles* filenames, uint8_t bucket, uint8_t idBits, bool asyncIo );
     ~BwtCycler();
     
-    void run( uint8_t* inChars, uint8_t* inEnds, uint8_t cycle );
-    void finish( uint8_t cycle );
+    static void run( BwtCycler* (&cyclers)[4], uint8_t* inChars, uint8_t* inEnds, uint16_t cycle, int threadCount );
+    static void finish( BwtCycler* (&cyclers)[4], uint16_t cycle, int threadCount );
     
 private:
-    void finishIter( uint8_t i );
-    void flush( uint8_t cycle );
-    void prepIn();
-    void prepIter();
+    void append( BwtCycler* seg );
+    void appendRun( uint8_t c, ReadId runLen );
+    void finishBucket( uint16_t cycle );
+    void finishIter();
+    void flush();
+    void flushFinal();
+    void prepIn( uint16_t cycle );
+    void prepIter( uint8_t seg );
     void prepOut();
     void prepOutFinal();
     void readIds();
-    void readBwtIn();
-    void readInsertBuff();
     void readNextId();
     void readNextPos();
     void readNextSap();
     void rewriteEnd( ReadId runLen );
-    void runIter( uint8_t i );
+    void runBucket( uint8_t* inChars, uint8_t* inEnds, uint16_t cycle );
+    void runIter();
     void setReadEnds();
+    static void setSizes( BwtCycler* (&cyclers)[4], uint16_t cycle );
     void setWriteEnds();
-    void writeIdsToFile( uint8_t i, uint8_t j );
     void writeBwt();
     void writeBwtByte( uint8_t c );
     void writeEnd();
-    void writeInsBuff( uint8_t i );
     void writeInsBytes();
     void writeLast();
     void writeNext();
@@ -64,6 +68,7 @@ private:
     void writeRun( uint8_t c, ReadId runLen );
     void writeSame();
     void writeSplit();
+    void writeTail();
     
     // Files
     PreprocessFiles* fns;
@@ -73,28 +78,27 @@ private:
     FILE* inEnd,* outEnd;
 //    FILE* dupes;
     CharId id;
+    uint8_t bucket, idBits;
+    
+    // Ends are never packed, so that the final ids file can be read at random; they take 64 bits only when ids need more than 32
+    uint8_t endBits;
     
     // Buffers
     uint8_t* chars,* ends;
-    uint8_t* inBwtBuff,* outBwtBuff;
-    uint8_t* inInsBuff,* outInsBuff[4];
-    ReadId* inIdsBuff[5],* outIdsBuff[4][5];
-    ReadId* inEndBuff,* outEndBuff;
     
-    // Buffer pointers
-    ReadId pInBwt, pOutBwt;
-    ReadId pInIns, pOutIns[4];
-    ReadId pInIds[5], pOutIds[4][5];
-    ReadId pInEnd, pOutEnd;
+    // Buffered streams over the files above, which also count what they write; the ring, when used, must outlive them
+    IoRing ring;
+    IoRing* io;
+    ByteReader bwtIn, insIn;
+    ByteWriter bwtOut, insOut[4];
+    IdReader idsIn[5], endIn;
+    IdWriter idsOut[4][5], endOut;
     
     // Counts
     CharId bwtCount, bwtLeft;
-    CharId charCounts[5], charSizes[5];
-    CharId insLeft, lastIns[4], insCounts[4];
-    ReadId endLeft, idsLeft[5];
+    CharId charCounts[5], bucketSize, insBases[4];
+    CharId insLeft, lastIns[4];
     ReadId inSapCount[5], outSapCount[5];
-    ReadId endCount;
-    CharId idsCounts[4][5];
     
     uint64_t inSap8[5], outSap8[5];
     uint32_t inSap4[5], outSap4[5];
@@ -103,9 +107,9 @@ private:
     
     uint8_t sapSize;
     
-    bool nextSame, bwtFirst, currSplit;
-    uint8_t thisChar, nextChar, lastChar, splitChar;
-    ReadId nextId, lastRun, splitRun;
+    bool nextSame, bwtFirst, holdFirst, currSplit, sized;
+    uint8_t thisChar, nextChar, firstChar, lastChar, splitChar;
+    ReadId nextId, firstRun, lastRun, splitRun;
     CharId currPos, nextPos;
     ReadId basePos[4];
     
@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "transform_chunks.h"
+#include "transform_streams.h"
+#include "pack_bases.h"
+#include "scheduler.h"
+#include "shared_functions.h"
+#include <atomic>
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+
+// Runs are written as in the final BWT: a byte of character and length, and past its largest length, seven bits more per byte
+static inline CharId readRun( const uint8_t* bwt, CharId &p, uint8_t &c )
+{
+    uint8_t b = bwt[p++];
+    CharId runLen;
+    if ( b < 252 )
+    {
+        c = b / 63;
+        runLen = b % 63 + 1;
+        if ( runLen < 63 ) return runLen;
+    }
+    else
+    {
+        c = 4;
+        runLen = b - 251;
+        if ( runLen < 4 ) return runLen;
+    }
+    for ( int shift = 0;; shift += 7 )
+    {
+        uint8_t runByte = bwt[p++];
+        runLen += CharId( runByte & 127 ) << shift;
+        if ( !( runByte & 128 ) ) return runLen;
+    }
+}
+
+static void readFailed()
+{
+    cerr << endl << "Error: input data files appear either incomplete or corrupted." << endl;
+    exit( EXIT_FAILURE );
+}
+
+ChunkRanks::ChunkRanks( Filenames* fns )
+{
+    FILE* fp = fns->getReadPointer( fns->bwt, false );
+    uint8_t bwtBegin;
+    CharId bwtCount;
+    if ( fread( &bwtBegin, 1, 1, fp ) != 1
+            || fread( &id, 8, 1, fp ) != 1
+            || fread( &bwtCount, 8, 1, fp ) != 1
+            || fread( &endCount, 8, 1, fp ) != 1
+            || fread( &charCounts, 8, 4, fp ) != 4 ) readFailed();
+    bwt.resize( bwtCount );
+    if ( fread( bwt.data(), 1, bwtCount, fp ) != bwtCount ) readFailed();
+    fclose( fp );
+    
+    // Ids are left open after their header, as they are read at random to order identical strings and then in full
+    ids = fns->getReadPointer( fns->ids, false );
+    if ( fread( idsHead, 1, 1, ids ) != 1 || fread( idsHead + 1, 1, idsHead[0] - 1, ids ) != idsHead[0] - 1u ) readFailed();
+    endBits = idsHead[0] > 9 ? idsHead[9] * 8 : 32;
+    
+    size = endCount;
+    for ( int i ( 0 ); i < 4; i++ )
+    {
+        starts[i] = size;
+        size += charCounts[i];
+    }
+    
+    Mark mark{ 0, 0, { 0, 0, 0, 0 } };
+    marks.reserve( size / RANK_MARK + 1 );
+    for ( CharId p = 0; p < bwtCount; )
+    {
+        uint8_t c;
+        CharId q = p, runLen = readRun( bwt.data(), p, c );
+        while ( marks.size() * RANK_MARK < mark.pos + runLen )
+        {
+            marks.push_back( mark );
+            marks.back().byte = q;
+        }
+        mark.pos += runLen;
+        if ( c < 4 ) mark.counts[c] += runLen;
+    }
+    mark.byte = bwtCount;
+    while ( marks.size() * RANK_MARK <= size ) marks.push_back( mark );
+}
+
+ChunkRanks::~ChunkRanks()
+{
+    fclose( ids );
+}
+
+void ChunkRanks::place( const uint8_t* chars, uint16_t len, ReadId strId, CharId* rows ) const
+{
+    // Rows with the same suffix are ordered by the bases before it read backwards, a string's start coming first, then identical strings by id
+    CharId lo = 0, hi = endCount, tied[len + 1];
+    for ( uint16_t k = 0; k <= len; k++ )
+    {
+        CharId los[4], his[4];
+        rank( lo, hi, los, his );
+        
+        // Rows here of strings that start with this suffix
+        CharId starting = hi - lo;
+        for ( int c ( 0 ); c < 4; c++ ) starting -= his[c] - los[c];
+        rows[k] = lo;
+        tied[k] = starting;
+        if ( k == len )
+        {
+            if ( starting && strId < endCount ) tied[k] = idsBefore( lo - los[0] - los[1] - los[2] - los[3], starting, strId );
+            break;
+        }
+        uint8_t next = chars[k];
+        for ( int c ( 0 ); c < next; c++ ) tied[k] += his[c] - los[c];
+        lo = starts[next] + los[next];
+        hi = starts[next] + his[next];
+    }
+    
+    // A row's place among those it is level with is settled by the rows after it, from the string's start back to its end
+    for ( CharId before = 0, k = len + 1; k--; ) rows[k] += ( before += tied[k] );
+}
+
+void ChunkRanks::rank( CharId lo, CharId hi, CharId (&los)[4], CharId (&his)[4] ) const
+{
+    // Whole runs are counted, and what the last overran taken back; hi is counted on from lo unless a mark lies between them
+    const Mark* mark = &marks[ lo / RANK_MARK ];
+    CharId p = mark->byte, runPos = mark->pos, counts[4];
+    memcpy( counts, mark->counts, sizeof( counts ) );
+    uint8_t c = 4;
+    for ( int i ( 0 ); i < 2; i++ )
+    {
+        CharId pos = i ? hi : lo;
+        CharId (&out)[4] = i ? his : los;
+        mark = &marks[ pos / RANK_MARK ];
+        if ( mark->pos > runPos )
+        {
+            p = mark->byte;
+            runPos = mark->pos;
+            memcpy( counts, mark->counts, sizeof( counts ) );
+            c = 4;
+        }
+        while ( runPos < pos )
+        {
+            CharId runLen = readRun( bwt.data(), p, c );
+            if ( c < 4 ) counts[c] += runLen;
+            runPos += runLen;
+        }
+        memcpy( out, counts, sizeof( out ) );
+        if ( c < 4 ) out[c] -= runPos - pos;
+    }
+}
+
+ReadId ChunkRanks::idsBefore( CharId endRank, CharId count, ReadId strId ) const
+{
+    // Identical strings are read in order of id, so only those before the one given are counted
+    uint8_t idBytes = endBits / 8;
+    vector<uint8_t> buff( count * idBytes );
+    if ( pread( fileno( ids ), buff.data(), buff.size(), idsHead[0] + endRank * idBytes ) != (ssize_t)buff.size() ) readFailed();
+    ReadId before = 0;
+    for ( CharId i = 0; i < count; i++ )
+    {
+        uint64_t endId = 0;
+        memcpy( &endId, &buff[ i * idBytes ], idBytes );
+        if ( endId < strId ) before++;
+    }
+    return before;
+}
+
+ChunkTransform::ChunkTransform( PreprocessFiles* filenames, int chunkCount )
+: fns( filenames )
+{
+    bin = fns->getBinary( true, false );
+    fread( &seqsBegin, 1, 1, bin );
+    readBinaryLength( bin, seqsBegin, readLen, cycle );
+    fseek( bin, 11, SEEK_SET );
+    fread( &revComp, 1, 1, bin );
+    fseek( bin, 20, SEEK_SET );
+    fread( &libCount, 1, 1, bin );
+    fseek( bin, 16, SEEK_SET );
+    ReadId seqCount = readBinaryCount( bin, 21 + libCount * 12 );
+    
+    lenBytes = readLen > 255 ? 2 : 1;
+    lineLen = lenBytes + ( readLen + 3 ) / 4;
+    lineCount = revComp ? seqCount / 2 : seqCount;
+    
+    // Chunks divide the sequences evenly, and are never empty
+    chunkCount = max( 1, (int)min( (ReadId)chunkCount, lineCount ) );
+    for ( int i ( 0 ); i <= chunkCount; i++ ) lineBegins.push_back( (CharId)lineCount * i / chunkCount );
+    for ( int i ( 0 ); i < chunkCount; i++ ) chunks.push_back( fns->getChunk( i, chunkCount ) );
+}
+
+ChunkTransform::~ChunkTransform()
+{
+    fclose( bin );
+    for ( PreprocessFiles* chunk : chunks ) delete chunk;
+}
+
+void ChunkTransform::finish()
+{
+    // Chunks are removed before the whole is marked complete, so that a resume never finds it complete with chunks left behind
+    for ( PreprocessFiles* chunk : chunks )
+    {
+        chunk->removeFile( chunk->bin );
+        chunk->removeFile( chunk->bwt );
+        chunk->removeFile( chunk->ids );
+    }
+    FILE* fp = fns->getReadPointer( fns->bin, true );
+    writeBinaryCycle( fp, seqsBegin, readLen, readLen + 1 );
+    fclose( fp );
+}
+
+void ChunkTransform::merge( int threadCount )
+{
+    // Chunks are merged in pairs, then the pairs in pairs; every merge but the last writes files of its own beside its first chunk's
+    vector<Filenames*> nodes( chunks.begin(), chunks.end() );
+    for ( size_t width = 1, level = 1; width < chunks.size(); width *= 2, level++ )
+    {
+        for ( size_t a = 0; a + width < chunks.size(); a += 2 * width )
+        {
+            size_t b = a + width, e = min( b + width, chunks.size() );
+            Filenames* out = !a && e == chunks.size() ? fns : new Filenames( chunks[a]->prefix + "-merge" + to_string( level ) );
+            merge( nodes[a], nodes[b], lineBegins[b], lineBegins[e], out, threadCount );
+            
+            // The chunks themselves are kept until the whole is complete, so that an interrupted merge can begin again from them
+            for ( size_t i : { a, b } )
+            {
+                if ( nodes[i] == chunks[i] ) continue;
+                nodes[i]->removeFile( nodes[i]->bwt );
+                nodes[i]->removeFile( nodes[i]->ids );
+                delete nodes[i];
+            }
+            nodes[a] = out;
+        }
+    }
+}
+
+void ChunkTransform::merge( Filenames* first, Filenames* second, ReadId lineBegin, ReadId lineEnd, Filenames* out, int threadCount )
+{
+    ChunkRanks* ranks[2] = { new ChunkRanks( first ), new ChunkRanks( second ) };
+    CharId size = ranks[0]->size + ranks[1]->size;
+    
+    // Every string of the second is placed from its end in both BWTs, marking where each of its rows falls among the first's
+    vector< atomic<uint64_t> > fromSecond( size / 64 + 1 );
+    ReadId batchLines = max( (ReadId)1, ReadId( 16777216 / lineLen ) );
+    vector<uint8_t> lines( (CharId)batchLines * lineLen );
+    for ( ReadId line = lineBegin; line < lineEnd; )
+    {
+        ReadId count = min( batchLines, lineEnd - line );
+        CharId bytes = (CharId)count * lineLen;
+        if ( pread( fileno( bin ), lines.data(), bytes, seqsBegin + (CharId)line * lineLen ) != (ssize_t)bytes ) readFailed();
+        
+        ReadId strings = count * ( revComp ? 2 : 1 ), firstId = ( line - lineBegin ) * ( revComp ? 2 : 1 );
+        WorkScheduler::run( ( strings + 1023 ) / 1024, threadCount, [&]( size_t job ){
+            uint8_t seq[readLen + 3], chars[readLen];
+            CharId rows[2][readLen + 1];
+            for ( ReadId k = job * 1024; k < min( strings, ReadId( ( job + 1 ) * 1024 ) ); k++ )
+            {
+                bool rev = revComp && ( k & 1 );
+                uint8_t* line = &lines[ CharId( revComp ? k / 2 : k ) * lineLen ];
+                uint16_t len = lenBytes > 1 ? line[0] | ( line[1] << 8 ) : line[0];
+                unpackBases( line + lenBytes, len, seq );
+                for ( uint16_t j = 0; j < len; j++ ) chars[j] = rev ? 3 - seq[j] : seq[len-1-j];
+                
+                ranks[0]->place( chars, len, ranks[0]->endCount, rows[0] );
+                ranks[1]->place( chars, len, firstId + k, rows[1] );
+                for ( uint16_t j = 0; j <= len; j++ )
+                {
+                    CharId row = rows[0][j] + rows[1][j];
+                    fromSecond[ row / 64 ].fetch_or( (uint64_t)1 << ( row % 64 ), memory_order_relaxed );
+                }
+            }
+        } );
+        line += count;
+    }
+    
+    // Ids keep the width and header of the first, the second's following on from the first's
+    FILE* outBwt = out->getWritePointer( out->bwt ),* outIds = out->getWritePointer( out->ids );
+    fwrite( ranks[0]->idsHead, 1, ranks[0]->idsHead[0], outIds );
+    
+    uint8_t bwtBegin = 57;
+    CharId bwtCount = 0, endCount = ranks[0]->endCount + ranks[1]->endCount, charCounts[4];
+    for ( int i ( 0 ); i < 4; i++ ) charCounts[i] = ranks[0]->charCounts[i] + ranks[1]->charCounts[i];
+    fwrite( &bwtBegin, 1, 1, outBwt );
+    fwrite( &ranks[0]->id, 8, 1, outBwt );
+    fwrite( &bwtCount, 8, 1, outBwt );
+    fwrite( &endCount, 8, 1, outBwt );
+    fwrite( &charCounts, 8, 4, outBwt );
+    
+    IdReader idsIn[2];
+    IdWriter idsOut;
+    ByteWriter bwtOut;
+    for ( int s ( 0 ); s < 2; s++ ) idsIn[s].open( ranks[s]->ids, ranks[s]->endCount, ranks[s]->endBits );
+    idsOut.open( outIds, ranks[0]->endBits );
+    bwtOut.open( outBwt );
+    
+    // Runs of each are taken in the order marked, joining runs of the same character across the two
+    uint8_t lastChar = 5, runChar[2] = { 5, 5 };
+    CharId lastRun = 0, runLeft[2] = { 0, 0 }, p[2] = { 0, 0 };
+    auto writeLast = [&]()
+    {
+        if ( !lastRun ) return;
+        uint8_t maxBase = lastChar < 4 ? 62 : 3, baseBit = lastChar < 4 ? 63 * lastChar : 252;
+        CharId run = lastRun - 1;
+        if ( run < maxBase ) bwtOut.put( baseBit + run );
+        else
+        {
+            bwtOut.put( baseBit + maxBase );
+            for ( run -= maxBase; run >= 128; run >>= 7 ) bwtOut.put( 128 ^ ( run & 127 ) );
+            bwtOut.put( run );
+        }
+    };
+    for ( CharId i = 0; i < size; i++ )
+    {
+        int s = ( fromSecond[ i / 64 ].load( memory_order_relaxed ) >> ( i % 64 ) ) & 1;
+        if ( !runLeft[s] ) runLeft[s] = readRun( ranks[s]->bwt.data(), p[s], runChar[s] );
+        --runLeft[s];
+        uint8_t c = runChar[s];
+        if ( c != lastChar )
+        {
+            writeLast();
+            lastChar = c;
+            lastRun = 0;
+        }
+        ++lastRun;
+        if ( c == 4 ) idsOut.put( idsIn[s].get() + ( s ? ranks[0]->endCount : 0 ) );
+    }
+    writeLast();
+    bwtOut.flush();
+    idsOut.flush();
+    
+    fseek( outBwt, 9, SEEK_SET );
+    fwrite( &bwtOut.count, 8, 1, outBwt );
+    fclose( outBwt );
+    fclose( outIds );
+    for ( int s ( 0 ); s < 2; s++ ) delete ranks[s];
+}
+
+bool ChunkTransform::prep( int i )
+{
+    // A chunk's sequences are written afresh unless its transform is under way, and need no transform once it is complete
+    PreprocessFiles* chunk = chunks[i];
+    ReadId seqCount = ( lineBegins[i+1] - lineBegins[i] ) * ( revComp ? 2 : 1 );
+    if ( FILE* fp = chunk->getReadPointer( chunk->bin, false, true ) )
+    {
+        uint8_t chunkBegin = 0;
+        uint16_t chunkLen = 0, chunkCycle = 0;
+        fread( &chunkBegin, 1, 1, fp );
+        if ( chunkBegin == seqsBegin ) readBinaryLength( fp, chunkBegin, chunkLen, chunkCycle );
+        fseek( fp, 16, SEEK_SET );
+        bool same = chunkLen == readLen && readBinaryCount( fp, 21 + libCount * 12 ) == seqCount;
+        fclose( fp );
+        if ( same && chunkCycle > readLen ) return false;
+        if ( same && chunkCycle >= 2 ) return true;
+    }
+    split( i );
+    return true;
+}
+
+void ChunkTransform::split( int i )
+{
+    PreprocessFiles* chunk = chunks[i];
+    ReadId seqCount = ( lineBegins[i+1] - lineBegins[i] ) * ( revComp ? 2 : 1 );
+    CharId buffSize = 16777216 - ( 16777216 % lineLen );
+    vector<uint8_t> buff( max( buffSize, (CharId)seqsBegin ) );
+    vector<ReadId> readLens( readLen + 1, 0 );
+    
+    // The chunk's header is that of the whole, counting only its own sequences
+    FILE* out = chunk->getBinary( false, false );
+    if ( pread( fileno( bin ), buff.data(), seqsBegin, 0 ) != seqsBegin ) readFailed();
+    fwrite( buff.data(), 1, seqsBegin, out );
+    for ( CharId p = seqsBegin + (CharId)lineBegins[i] * lineLen, left = (CharId)( lineBegins[i+1] - lineBegins[i] ) * lineLen; left; )
+    {
+        CharId bytes = min( left, buffSize );
+        if ( pread( fileno( bin ), buff.data(), bytes, p ) != (ssize_t)bytes ) readFailed();
+        for ( CharId q = 0; q < bytes; q += lineLen )
+        {
+            readLens[ lenBytes > 1 ? buff[q] | ( buff[q+1] << 8 ) : buff[q] ]++;
+        }
+        fwrite( buff.data(), 1, bytes, out );
+        p += bytes;
+        left -= bytes;
+    }
+    fseek( out, 16, SEEK_SET );
+    writeBinaryCount( out, seqCount, 21 + libCount * 12 );
+    writeBinaryCycle( out, seqsBegin, readLen, 0 );
+    fclose( out );
+    
+    // The trim file keeps the shortest length and id width of the whole, counting the chunk's own reads of each length
+    uint8_t trmHead[4];
+    FILE* trm = fns->getReadPointer( fns->tmpTrm, false );
+    if ( fread( trmHead, 1, 4, trm ) != 4 ) readFailed();
+    fclose( trm );
+    trm = chunk->getWritePointer( chunk->tmpTrm );
+    fwrite( trmHead, 1, 4, trm );
+    for ( uint16_t j = trmHead[2]; j < readLen; j++ ) fwrite( &readLens[j], sizeof( ReadId ), 1, trm );
+    fclose( trm );
+}
+
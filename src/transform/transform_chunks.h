@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRANSFORM_CHUNKS_H
+#define TRANSFORM_CHUNKS_H
+
+#include "types.h"
+#include "filenames.h"
+
+#define RANK_MARK (CharId)64
+
+// A transformed BWT held in memory as written, marked every RANK_MARK positions with the run holding that position and the counts before it
+struct ChunkRanks
+{
+    ChunkRanks( Filenames* fns );
+    ~ChunkRanks();
+    
+    void place( const uint8_t* chars, uint16_t len, ReadId strId, CharId* rows ) const;
+    void rank( CharId lo, CharId hi, CharId (&los)[4], CharId (&his)[4] ) const;
+    
+    struct Mark
+    {
+        CharId byte, pos, counts[4];
+    };
+    
+    vector<uint8_t> bwt;
+    vector<Mark> marks;
+    FILE* ids;
+    CharId id, size, endCount, charCounts[4], starts[4];
+    uint8_t idsHead[10], endBits;
+    
+private:
+    ReadId idsBefore( CharId endRank, CharId count, ReadId strId ) const;
+};
+
+// Splits the sequences into chunks that are transformed separately, then merges their BWTs into that of the whole
+struct ChunkTransform
+{
+    ChunkTransform( PreprocessFiles* filenames, int chunkCount );
+    ~ChunkTransform();
+    
+    void finish();
+    void merge( int threadCount );
+    bool prep( int i );
+    
+    PreprocessFiles* fns;
+    vector<PreprocessFiles*> chunks;
+    uint16_t readLen, cycle;
+
+private:
+    void merge( Filenames* first, Filenames* second, ReadId lineBegin, ReadId lineEnd, Filenames* out, int threadCount );
+    void split( int i );
+    
+    FILE* bin;
+    vector<ReadId> lineBegins;
+    ReadId lineCount;
+    uint16_t lineLen;
+    uint8_t seqsBegin, lenBytes, revComp, libCount;
+};
+
+#endif /* TRANSFORM_CHUNKS_H */
+
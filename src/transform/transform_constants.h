@@ -28,6 +28,10 @@
 #define SAP_BUFFER (ReadId)20480
 #define POS_BUFFER (CharId)16384
 #define IDS_BUFFER (ReadId)16384
+#define READ_BATCH (ReadId)16384
+#define SINGLES_BUFFER (CharId)268435456
+#define MAX_READ_LEN 4096
+#define READ_DEPTH 4
 
 static const uint8_t byteToInt[][256] = 
 {
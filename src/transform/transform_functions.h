@@ -23,6 +23,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <string.h>
 #include "transform_structs.h"
 #include "transform_constants.h"
 
@@ -78,9 +79,93 @@ inline void writeIdsBuff( FILE* &fIds, ReadId* idsBuff, CharId &p )
     p = 0;
 }
 
+// Ids may be bit-packed to the width of the largest id; whole groups of 8 ids always fill whole bytes
+// Ids as wide as ReadId are read and written as they are, narrower ones such as 32-bit ids in a WIDE_IDS build are converted
+inline size_t packedBytes( ReadId n, uint8_t bits )
+{
+    return ( (CharId)n * bits + 7 ) / 8;
+}
+
+inline size_t packIds( const ReadId* ids, ReadId n, uint8_t bits, uint8_t* packed )
+{
+    if ( bits == 8 * sizeof( ReadId ) )
+    {
+        memcpy( packed, ids, n * sizeof( ReadId ) );
+        return n * sizeof( ReadId );
+    }
+    size_t q = 0;
+    uint64_t acc = 0;
+    uint8_t have = 0;
+    for ( ReadId i = 0; i < n; i++ )
+    {
+        acc |= (uint64_t)ids[i] << have;
+        for ( have += bits; have >= 8; have -= 8 )
+        {
+            packed[q++] = acc;
+            acc >>= 8;
+        }
+    }
+    if ( have ) packed[q++] = acc;
+    return q;
+}
+
+inline void unpackIds( const uint8_t* packed, ReadId* ids, ReadId n, uint8_t bits )
+{
+    if ( bits == 8 * sizeof( ReadId ) )
+    {
+        memcpy( ids, packed, n * sizeof( ReadId ) );
+        return;
+    }
+    ReadId mask = ( (ReadId)1 << bits ) - 1;
+    size_t q = 0;
+    uint64_t acc = 0;
+    uint8_t have = 0;
+    for ( ReadId i = 0; i < n; i++ )
+    {
+        while ( have < bits )
+        {
+            acc |= (uint64_t)packed[q++] << have;
+            have += 8;
+        }
+        ids[i] = acc & mask;
+        acc >>= bits;
+        have -= bits;
+    }
+}
+
+inline void readPackedIds( FILE* fp, ReadId* ids, ReadId n, uint8_t bits )
+{
+    if ( bits == 8 * sizeof( ReadId ) )
+    {
+        fread( ids, sizeof( ReadId ), n, fp );
+        return;
+    }
+    uint8_t packed[ 1024 * sizeof( ReadId ) ];
+    for ( ReadId i = 0; i < n; i += 1024 )
+    {
+        ReadId m = min( n - i, (ReadId)1024 );
+        fread( packed, 1, packedBytes( m, bits ), fp );
+        unpackIds( packed, ids + i, m, bits );
+    }
+}
+
+inline void writePackedIds( FILE* fp, ReadId* ids, ReadId n, uint8_t bits )
+{
+    if ( bits == 8 * sizeof( ReadId ) )
+    {
+        fwrite( ids, sizeof( ReadId ), n, fp );
+        return;
+    }
+    uint8_t packed[ 1024 * sizeof( ReadId ) ];
+    for ( ReadId i = 0; i < n; i += 1024 )
+    {
+        fwrite( packed, 1, packIds( ids + i, min( n - i, (ReadId)1024 ), bits, packed ), fp );
+    }
+}
+
 inline void writePosBuff( FILE* &fIds, FILE* &fPos, ReadId* idsBuff, CharId* posBuff, CharId &p )
 {
-    fwrite( idsBuff, 4, p, fIds );
+    fwrite( idsBuff, sizeof( ReadId ), p, fIds );
     fwrite( posBuff, 8, p, fPos );
     p = 0;
 }
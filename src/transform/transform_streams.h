@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2017 Glen T. Wilkins <glen.t.wilkins@gmail.com>
+ * Written by Glen T. Wilkins
+ * 
+ * This file is part of the LeanBWT software package <https://github.com/gtwilkins/LeanBWT>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRANSFORM_STREAMS_H
+#define TRANSFORM_STREAMS_H
+
+#include "types.h"
+#include "io_ring.h"
+#include "transform_functions.h"
+#include <cstdio>
+#include <fcntl.h>
+
+// Buffered streams over the temporary transform files, each holding its own buffer and cursor so that hot loops test only one inlined bound
+// The handles come from PreprocessFiles, so the same streams run over files on disk or held in memory by --mem
+// Buffers are allocated on first open, so that streams which a run never uses cost nothing
+// Opened with an io_uring, readers keep READ_DEPTH chunks in flight ahead of the cursor and writers write one buffer while filling the other
+
+// Hands out a file's chunks in order, each chunk handed out being refilled from further on once the next is asked for
+struct ReadAhead
+{
+    ReadAhead(): ring( NULL ), capacity( 0 ), cur( 0 ){ memset( chunks, 0, sizeof( chunks ) ); }
+    ~ReadAhead()
+    {
+        settle();
+        for ( int i ( 0 ); i < READ_DEPTH; i++ ) if ( chunks[i] ) delete[] chunks[i];
+    }
+    
+    void start( IoRing* r, FILE* f, CharId bytes, CharId inChunkSize )
+    {
+        settle();
+        if ( inChunkSize > capacity )
+        {
+            for ( int i ( 0 ); i < READ_DEPTH; i++ )
+            {
+                if ( chunks[i] ) delete[] chunks[i];
+                chunks[i] = new uint8_t[inChunkSize];
+            }
+            capacity = inChunkSize;
+        }
+        ring = r;
+        fd = fileno( f );
+        offset = ftell( f );
+        left = bytes;
+        chunkSize = inChunkSize;
+        cur = 0;
+        handed = false;
+        for ( int i ( 0 ); i < READ_DEPTH; i++ ) request( i );
+    }
+    
+    uint8_t* next( CharId &len )
+    {
+        if ( handed ) request( ( cur + READ_DEPTH - 1 ) % READ_DEPTH );
+        handed = true;
+        IoSlot &slot = slots[cur];
+        bool issued = slot.pending;
+        ring->wait( &slot );
+        len = issued ? slot.res : 0;
+        uint8_t* data = chunks[cur];
+        cur = ( cur + 1 ) % READ_DEPTH;
+        return data;
+    }
+    
+    void request( int i )
+    {
+        if ( !left ) return;
+        CharId len = min( left, chunkSize );
+        ring->read( fd, chunks[i], len, offset, &slots[i] );
+        offset += len;
+        left -= len;
+    }
+    
+    void settle()
+    {
+        if ( ring ) for ( int i ( 0 ); i < READ_DEPTH; i++ ) ring->wait( &slots[i] );
+    }
+    
+    IoRing* ring;
+    uint8_t* chunks[READ_DEPTH];
+    IoSlot slots[READ_DEPTH];
+    CharId capacity, chunkSize, offset, left;
+    int fd, cur;
+    bool handed;
+};
+
+// Writes a stream's full buffers while it fills the other of its two
+struct WriteBehind
+{
+    WriteBehind(): ring( NULL ), capacity( 0 ), cur( 0 ){ memset( bufs, 0, sizeof( bufs ) ); }
+    ~WriteBehind()
+    {
+        settle();
+        for ( int i ( 0 ); i < 2; i++ ) if ( bufs[i] ) delete[] bufs[i];
+    }
+    
+    // Anything already written to the file directly, such as a header, is flushed first so that the writes follow it
+    void start( IoRing* r, FILE* f, CharId bufSize )
+    {
+        settle();
+        if ( bufSize > capacity )
+        {
+            for ( int i ( 0 ); i < 2; i++ )
+            {
+                if ( bufs[i] ) delete[] bufs[i];
+                bufs[i] = new uint8_t[bufSize];
+            }
+            capacity = bufSize;
+        }
+        ring = r;
+        fflush( f );
+        fd = fileno( f );
+        offset = ftell( f );
+        cur = 0;
+    }
+    
+    uint8_t* buffer()
+    {
+        return bufs[cur];
+    }
+    
+    void submit( CharId len )
+    {
+        if ( len ) ring->write( fd, bufs[cur], len, offset, &slots[cur] );
+        offset += len;
+        cur = !cur;
+        ring->wait( &slots[cur] );
+    }
+    
+    // Leaves the file positioned after every write, so that it can again be written directly
+    void finish( FILE* f )
+    {
+        settle();
+        fseek( f, offset, SEEK_SET );
+    }
+    
+    void settle()
+    {
+        if ( ring ) for ( int i ( 0 ); i < 2; i++ ) ring->wait( &slots[i] );
+    }
+    
+    IoRing* ring;
+    uint8_t* bufs[2];
+    IoSlot slots[2];
+    CharId capacity, offset;
+    int fd, cur;
+};
+
+struct ByteReader
+{
+    ByteReader( CharId size=BWT_BUFFER, bool readahead=true ): fp( NULL ), ring( NULL ), own( NULL ), buff( NULL ), size( size ), p( 0 ), n( 0 ), left( 0 ), readahead( readahead ){}
+    ~ByteReader(){ if ( own ) delete[] own; }
+    
+    // Reads no further than bytes past the current file position
+    void open( FILE* f, CharId bytes, IoRing* r=NULL )
+    {
+        if ( readahead ) posix_fadvise( fileno( f ), 0, 0, POSIX_FADV_SEQUENTIAL );
+        fp = f;
+        ring = r;
+        left = bytes;
+        p = n = 0;
+        if ( ring ) ahead.start( ring, f, bytes, size );
+        else if ( !own ) own = new uint8_t[size];
+        buff = own;
+    }
+    
+    inline uint8_t get()
+    {
+        if ( p == n ) refill();
+        return buff[p++];
+    }
+    
+    void refill()
+    {
+        if ( ring ) buff = ahead.next( n );
+        else n = fread( buff, 1, min( left, size ), fp );
+        left -= n;
+        p = 0;
+    }
+    
+    FILE* fp;
+    IoRing* ring;
+    ReadAhead ahead;
+    uint8_t* own,* buff;
+    CharId size, p, n, left;
+    bool readahead;
+};
+
+struct ByteWriter
+{
+    ByteWriter( CharId size=BWT_BUFFER ): fp( NULL ), ring( NULL ), own( NULL ), buff( NULL ), size( size ), p( 0 ), count( 0 ){}
+    ~ByteWriter(){ if ( own ) delete[] own; }
+    
+    void open( FILE* f, IoRing* r=NULL )
+    {
+        fp = f;
+        ring = r;
+        p = count = 0;
+        if ( ring ) behind.start( ring, f, size );
+        else if ( !own ) own = new uint8_t[size];
+        buff = ring ? behind.buffer() : own;
+    }
+    
+    inline void put( uint8_t c )
+    {
+        if ( p == size ) drain();
+        buff[p++] = c;
+    }
+    
+    // Counts every byte written through the buffer, which excludes any header written to the file directly
+    void drain()
+    {
+        if ( ring )
+        {
+            behind.submit( p );
+            buff = behind.buffer();
+        }
+        else fwrite( buff, 1, p, fp );
+        count += p;
+        p = 0;
+    }
+    
+    void flush()
+    {
+        drain();
+        if ( ring ) behind.finish( fp );
+    }
+    
+    FILE* fp;
+    IoRing* ring;
+    WriteBehind behind;
+    uint8_t* own,* buff;
+    CharId size, p, count;
+};
+
+// Id buffers are kept to a multiple of 8, as packed ids only align on whole groups of 8, so every chunk read ahead holds a whole buffer
+struct IdReader
+{
+    IdReader( ReadId size=IDS_BUFFER, bool readahead=true ): fp( NULL ), ring( NULL ), buff( NULL ), size( size ), p( 0 ), n( 0 ), left( 0 ), bits( 0 ), readahead( readahead ){ assert( !( size % 8 ) ); }
+    ~IdReader(){ if ( buff ) delete[] buff; }
+    
+    void open( FILE* f, ReadId count, uint8_t idBits, IoRing* r=NULL )
+    {
+        if ( !buff ) buff = new ReadId[size];
+        if ( readahead && f ) posix_fadvise( fileno( f ), 0, 0, POSIX_FADV_SEQUENTIAL );
+        fp = f;
+        ring = f ? r : NULL;
+        left = count;
+        bits = idBits;
+        p = n = 0;
+        if ( ring ) ahead.start( ring, f, packedBytes( count, bits ), packedBytes( size, bits ) );
+    }
+    
+    inline ReadId get()
+    {
+        if ( p == n ) refill();
+        return buff[p++];
+    }
+    
+    void refill()
+    {
+        n = min( left, size );
+        if ( ring )
+        {
+            CharId len;
+            unpackIds( ahead.next( len ), buff, n, bits );
+        }
+        else readPackedIds( fp, buff, n, bits );
+        left -= n;
+        p = 0;
+    }
+    
+    FILE* fp;
+    IoRing* ring;
+    ReadAhead ahead;
+    ReadId* buff;
+    ReadId size, p, n, left;
+    uint8_t bits;
+    bool readahead;
+};
+
+struct IdWriter
+{
+    IdWriter( ReadId size=IDS_BUFFER ): fp( NULL ), ring( NULL ), buff( NULL ), size( size ), p( 0 ), count( 0 ), bits( 0 ){ assert( !( size % 8 ) ); }
+    ~IdWriter(){ if ( buff ) delete[] buff; }
+    
+    void open( FILE* f, uint8_t idBits, IoRing* r=NULL )
+    {
+        if ( !buff ) buff = new ReadId[size];
+        fp = f;
+        ring = r;
+        bits = idBits;
+        p = count = 0;
+        if ( ring ) behind.start( ring, f, size * sizeof( ReadId ) );
+    }
+    
+    inline void put( ReadId id )
+    {
+        if ( p == size ) drain();
+        buff[p++] = id;
+        ++count;
+    }
+    
+    void drain()
+    {
+        if ( ring ) behind.submit( packIds( buff, p, bits, behind.buffer() ) );
+        else writePackedIds( fp, buff, p, bits );
+        p = 0;
+    }
+    
+    void flush()
+    {
+        drain();
+        if ( ring ) behind.finish( fp );
+    }
+    
+    FILE* fp;
+    IoRing* ring;
+    WriteBehind behind;
+    ReadId* buff;
+    ReadId size, p, count;
+    uint8_t bits;
+};
+
+#endif /* TRANSFORM_STREAMS_H */
@@ -22,19 +22,13 @@
 #include <cassert>
 #include <iostream>
 
-ReadFile::ReadFile( string filename, int baseReadLen, int minScore )
-: readLen( baseReadLen ), minPhred( minScore )
+ReadFile::ReadFile( string filename, int baseReadLen, int minScore, int threadCount )
+: readLen( baseReadLen ), minPhred( minScore ), pHeld( 0 )
 {
-    fh.open( filename );
-    
-    if ( !fh.good() || !fh.is_open() )
-    {
-        cerr << "Error: could not open file \"" << filename << "\"" << endl;
-        exit( EXIT_FAILURE );
-    }
+    fh = new SeqStream( filename, threadCount );
     
     string line;
-    if ( getline( fh, line ) && !line.empty() )
+    if ( fh->getLine( line ) && !line.empty() )
     {
         if ( line[0] == '>' )
         {
@@ -47,7 +41,7 @@ ReadFile::ReadFile( string filename, int baseReadLen, int minScore )
         else if ( charToInt[ line[0] ] < 6 )
         {
             fileType = 0;
-            fh.seekg( 0 );
+            held.push_back( line );
         }
         else
         {
@@ -59,45 +53,109 @@ ReadFile::ReadFile( string filename, int baseReadLen, int minScore )
     setReadLen();
 }
 
-bool ReadFile::getNext( string &seq )
+ReadFile::~ReadFile()
 {
-    if ( getline( fh, seq ) )
+    delete fh;
+}
+
+void ReadFile::clean( const char* text, ReadRecord &rec )
+{
+    // Keeps the longest run free of Ns and low quality bases by moving the record's offsets, leaving the text as is
+    const char* seq = text + rec.seq,* qual = text + rec.qual;
+    uint32_t qualLen = fileType == 3 ? rec.qualLen : 0;
+    int iBest = 0;
+    int bestLen = -1;
+    int iCurr = 0;
+    for ( int i( 0 ); i < rec.seqLen; i++ )
     {
-        if ( fileType ) getline( fh, line );
-        if ( fileType == 3 )
+        if ( i >= qualLen || qual[i] >= minPhred )
         {
-            getline( fh, line );
-            for ( int i( 0 ); i < line.size(); i++ )
+            if ( charToInt[ (uint8_t)seq[i] ] < 4 ) continue;
+            if ( charToInt[ (uint8_t)seq[i] ] == 6 )
             {
-                if ( line[i] < minPhred ) seq[i] = 'N';
+                cerr << "Error: Unrecognised character \"" << seq[i] << "\" in sequence file." << endl;
+                exit( EXIT_FAILURE );
             }
-            getline( fh, line );
         }
-        
-        trimSeq( seq );
-        
-        return true;
+        int len = i - iCurr;
+        if ( len > bestLen )
+        {
+            iBest = iCurr;
+            bestLen = len;
+        }
+        iCurr = i + 1;
     }
     
-    return false;
+    if ( bestLen > -1 )
+    {
+        int currLen = rec.seqLen - iCurr;
+        if ( currLen > bestLen )
+        {
+            iBest = iCurr;
+            bestLen = currLen;
+        }
+        rec.seq += iBest;
+        rec.seqLen = bestLen;
+    }
+}
+
+bool ReadFile::getLine( const char* &line, size_t &len )
+{
+    // Held lines are only let go on the call after the last of them, which may still be in use until then
+    if ( pHeld && pHeld == held.size() )
+    {
+        held.clear();
+        pHeld = 0;
+    }
+    if ( pHeld == held.size() ) return fh->getLine( line, len );
+    line = held[pHeld].data();
+    len = held[pHeld++].size();
+    return true;
+}
+
+bool ReadFile::getRecord( vector<char> &text, vector<ReadRecord> &records )
+{
+    // Only the sequence and quality lines of the next record are copied, to the end of the batch text
+    const char* line;
+    size_t len;
+    if ( !getLine( line, len ) ) return false;
+    ReadRecord rec{ text.size(), 0, (uint32_t)len, 0 };
+    text.insert( text.end(), line, line + len );
+    if ( fileType ) getLine( line, len );
+    if ( fileType == 3 )
+    {
+        getLine( line, len );
+        rec.qual = text.size();
+        rec.qualLen = len;
+        text.insert( text.end(), line, line + len );
+        getLine( line, len );
+    }
+    records.push_back( rec );
+    return true;
 }
 
 void ReadFile::setReadLen()
 {
+    // Sample the first reads without seeking, holding their lines to be read again; any header is already read
     string seq;
-    size_t curr = fh.tellg();
-    fh.seekg( 0 );
-    int i = 0, j = 0;
-    while ( getline( fh, seq ) && !seq.empty() && i < 1000 )
+    int i = 0, j = fileType ? 1 : 0;
+    for ( size_t k = 0; i < 1000; k++ )
     {
+        if ( k == held.size() )
+        {
+            if ( !fh->getLine( seq ) ) break;
+            held.push_back( seq );
+        }
+        seq = held[k];
+        if ( seq.empty() ) break;
         if ( !fileType || j == 1 )
         {
-            if ( seq.length() > 255 )
+            if ( seq.length() > MAX_READ_LEN )
             {
-                cerr << "Error: Read length of " << seq.length() << " detected. Maximum length of 255 is supported." << endl;
+                cerr << "Error: Read length of " << seq.length() << " detected. Maximum length of " << MAX_READ_LEN << " is supported." << endl;
                 exit( EXIT_FAILURE );
             }
-            readLen = max( readLen, (uint8_t)seq.length() );
+            readLen = max( readLen, (uint16_t)seq.length() );
         }
         if ( j++ == fileType )
         {
@@ -111,42 +169,19 @@ void ReadFile::setReadLen()
         cerr << "Error: Read length of " << seq.length() << " detected. Minimum length of 80 is supported." << endl;
         exit( EXIT_FAILURE );
     }
-    fh.clear();
-    fh.seekg( curr );
 }
 
-void ReadFile::trimSeq( string &seq )
+ReadBatch::ReadBatch( uint16_t readLen )
+: readLens( readLen + 1, 0 ), count( 0 ), written( 0 ), discarded( 0 )
 {
-    int iBest = 0;
-    int bestLen = -1;
-    int iCurr = 0;
-    for ( int i( 0 ); i < seq.length(); i++ )
-    {
-        if ( charToInt[ seq[i] ] >= 4 )
-        {
-            if ( charToInt[ seq[i] ] == 6 )
-            {
-                cerr << "Error: Unrecognised character \"" << seq[i] << "\" in sequence file." << endl;
-                exit( EXIT_FAILURE );
-            }
-            int len = i - iCurr;
-            if ( len > bestLen )
-            {
-                iBest = iCurr;
-                bestLen = len;
-            }
-            iCurr = i + 1;
-        }
-    }
-    
-    if ( bestLen > -1 )
-    {
-        int currLen = seq.length() - iCurr;
-        if ( currLen > bestLen )
-        {
-            iBest = iCurr;
-            bestLen = currLen;
-        }
-        seq = seq.substr( iBest, bestLen );
-    }
+    for ( int i ( 0 ); i < 4; i++ ) for ( int j ( 0 ); j < 4; j++ ) charPlaceCounts[i][j].resize( readLen, 0 );
+}
+
+void ReadBatch::clear()
+{
+    lines.clear();
+    singleLines.clear();
+    for ( int i ( 0 ); i < 4; i++ ) for ( int j ( 0 ); j < 4; j++ ) fill( charPlaceCounts[i][j].begin(), charPlaceCounts[i][j].end(), 0 );
+    fill( readLens.begin(), readLens.end(), 0 );
+    written = discarded = 0;
 }
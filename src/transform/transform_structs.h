@@ -24,17 +24,44 @@
 #include "types.h"
 #include "constants.h"
 #include "transform_constants.h"
+#include "seq_stream.h"
 #include <fstream>
 
+// The sequence and quality lines of one record, as offsets into the text of its batch
+struct ReadRecord
+{
+    size_t seq, qual;
+    uint32_t seqLen, qualLen;
+};
+
 struct ReadFile
 {
-    ReadFile( string filename, int baseReadLen, int minScore );
-    bool getNext( string &seq );
+    ReadFile( string filename, int baseReadLen, int minScore, int threadCount=1 );
+    ~ReadFile();
+    void clean( const char* text, ReadRecord &rec );
+    bool getLine( const char* &line, size_t &len );
+    bool getRecord( vector<char> &text, vector<ReadRecord> &records );
     void setReadLen();
-    void trimSeq( string &seq );
-    ifstream fh;
-    string line;
-    uint8_t fileType, readLen, minPhred;
+    SeqStream* fh;
+    
+    // Lines already read while sampling, to be returned again before any more of the file
+    vector<string> held;
+    size_t pHeld;
+    uint8_t fileType, minPhred;
+    uint16_t readLen;
+};
+
+// Reads taken from one library in input order, to be parsed and encoded on any thread and then written in turn
+struct ReadBatch
+{
+    ReadBatch( uint16_t readLen );
+    void clear();
+    
+    vector<char> text[2];
+    vector<ReadRecord> records[2];
+    vector<uint8_t> lines, singleLines;
+    vector<ReadId> charPlaceCounts[4][4], readLens;
+    ReadId count, written, discarded;
 };
 
 #endif /* TRANSFORM_STRUCTS_H */
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Checks that a transform built in chunks and merged is the same as one built whole
+# usage: tests/chunked_build.sh [leanbwt binary]
+bin=$( cd "$( dirname "${1:-./leanbwt}" )" && pwd )/$( basename "${1:-./leanbwt}" )
+dir=$( mktemp -d )
+trap 'rm -rf "$dir"' EXIT
+
+# Random 100 bp reads of differing lengths, with repeats so that identical strings and shared suffixes are merged
+awk 'BEGIN { srand( 11 ); for ( i = 0; i < 3000; i++ ) { if ( i % 7 == 6 ) s = prev; else { s = ""; n = 60 + int( rand() * 41 ); for ( j = 0; j < n; j++ ) s = s substr( "ACGT", int( rand() * 4 ) + 1, 1 ) } prev = s; print ">r" i; print s } }' > "$dir/reads.fa"
+echo "single $dir/reads.fa" > "$dir/in.txt"
+
+fail()
+{
+    echo "FAIL: $1"
+    [ -f "$2" ] && cat "$2"
+    exit 1
+}
+
+"$bin" index -i "$dir/in.txt" -p "$dir/whole/out" > "$dir/whole.log" 2>&1 || fail "building whole" "$dir/whole.log"
+for n in 2 3 4; do
+    "$bin" index -i "$dir/in.txt" -p "$dir/chunks$n/out" --chunks $n > "$dir/chunks$n.log" 2>&1 || fail "building in $n chunks" "$dir/chunks$n.log"
+    
+    # Files begin with a random session id, so they are compared after it
+    for f in bwt ids; do
+        tail -c +10 "$dir/whole/out-$f.dat" > "$dir/expected"
+        tail -c +10 "$dir/chunks$n/out-$f.dat" > "$dir/actual"
+        cmp -s "$dir/expected" "$dir/actual" || fail "$n chunks differ in -$f.dat"
+    done
+    ls "$dir/chunks$n" | grep -q -e chunk -e merge -e tmp && fail "$n chunks left files behind"
+done
+echo "PASS: chunked build"
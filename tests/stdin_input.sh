@@ -0,0 +1,44 @@
+#!/bin/sh
+# Checks that input read from standard input, whether redirected from a file or piped, transforms the same as the file itself
+# usage: tests/stdin_input.sh [leanbwt binary]
+bin=$( cd "$( dirname "${1:-./leanbwt}" )" && pwd )/$( basename "${1:-./leanbwt}" )
+dir=$( mktemp -d )
+trap 'rm -rf "$dir"' EXIT
+
+# Interleaved pairs of random 100 bp reads, gzip-compressed
+awk 'BEGIN { srand( 7 ); for ( i = 0; i < 4000; i++ ) { s = ""; q = ""; for ( j = 0; j < 100; j++ ) { s = s substr( "ACGT", int( rand() * 4 ) + 1, 1 ); q = q "I" } print "@r" i; print s; print "+"; print q } }' | gzip > "$dir/reads.fq.gz"
+echo "paired $dir/reads.fq.gz" > "$dir/file.txt"
+echo "paired -" > "$dir/stdin.txt"
+
+fail()
+{
+    echo "FAIL: $1"
+    [ -f "$2" ] && cat "$2"
+    exit 1
+}
+
+"$bin" index -i "$dir/file.txt" -p "$dir/file/out" > "$dir/file.log" 2>&1 || fail "reading from a file" "$dir/file.log"
+"$bin" index -i "$dir/stdin.txt" -p "$dir/redirect/out" < "$dir/reads.fq.gz" > "$dir/redirect.log" 2>&1 || fail "reading from stdin redirected from a file" "$dir/redirect.log"
+cat "$dir/reads.fq.gz" | "$bin" index -i "$dir/stdin.txt" -p "$dir/pipe/out" > "$dir/pipe.log" 2>&1 || fail "reading from piped stdin" "$dir/pipe.log"
+
+# Files begin with a random session id, so they are compared after it
+for run in redirect pipe; do
+    for f in bwt ids; do
+        tail -c +10 "$dir/file/out-$f.dat" > "$dir/expected"
+        tail -c +10 "$dir/$run/out-$f.dat" > "$dir/actual"
+        cmp -s "$dir/expected" "$dir/actual" || fail "$run stdin differs in -$f.dat"
+    done
+done
+# Input cut off partway through a gzip member must fail rather than pass for the end of the file
+head -c 20000 "$dir/reads.fq.gz" > "$dir/cut.fq.gz"
+echo "paired $dir/cut.fq.gz" > "$dir/cut.txt"
+for run in file redirect pipe; do
+    case $run in
+        file) "$bin" index -i "$dir/cut.txt" -p "$dir/cut-$run/out" > "$dir/cut.log" 2>&1 ;;
+        redirect) "$bin" index -i "$dir/stdin.txt" -p "$dir/cut-$run/out" < "$dir/cut.fq.gz" > "$dir/cut.log" 2>&1 ;;
+        pipe) cat "$dir/cut.fq.gz" | "$bin" index -i "$dir/stdin.txt" -p "$dir/cut-$run/out" > "$dir/cut.log" 2>&1 ;;
+    esac && fail "truncated gzip input was accepted when read from $run" "$dir/cut.log"
+    grep -q "could not decompress" "$dir/cut.log" || fail "truncated gzip input read from $run gave no decompression error" "$dir/cut.log"
+done
+
+echo "PASS: stdin input"